@@ -0,0 +1,131 @@
+/*=================================================================
+ *  callstats.h
+ *
+ *  work counts and phase timings of one call, returned by the
+ *  scanning tools as an optional stats output (a 1 x 1 struct):
+ *
+ *      windows         windows scored
+ *      abandoned       windows whose scoring stopped early because
+ *                      the threshold could no longer be reached
+ *      hits_raw        windows passing the threshold, overlapping or not
+ *      hits            hits left after overlap removal
+ *      bytes_encoded   bytes of sequence read and converted
+ *      time_encode, time_scan, time_resolve, time_output
+ *                      wall time in seconds of each phase (see
+ *                      phaseprof.h), from the monotonic clock
+ *                      (QueryPerformanceCounter on Windows). a strict
+ *                      ISO C build without POSIX clocks falls back to
+ *                      timespec_get (C11), or else to the CPU time of
+ *                      clock()
+ *      time_cpu        1 if the times are CPU time from clock(), else 0
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef CALLSTATS_H
+#define CALLSTATS_H
+
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+#include "mex.h"
+#include "phaseprof.h"
+
+typedef struct
+{
+    long long windows, abandoned, hitsRaw, hits, bytes;
+    double    time[PP_NPHASE];
+    double    start;
+    int       phase;
+} CallStats;
+
+
+/* 1 when only clock() is available and the phase times are CPU time */
+
+#if defined(_WIN32) || defined(CLOCK_MONOTONIC) || defined(TIME_UTC)
+#define STATS_CPU_TIME  0
+#else
+#define STATS_CPU_TIME  1
+#endif
+
+
+static double StatsClock(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER freq, now;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    return (double)now.QuadPart/(double)freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+#elif defined(TIME_UTC)
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+
+    return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+#else
+    return (double)clock()/(double)CLOCKS_PER_SEC;
+#endif
+}
+
+
+static void StatsInit(CallStats *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->phase = PP_NONE;
+}
+
+
+/* end the running phase and start the next (PP_NONE to stop) */
+
+static void StatsPhase(CallStats *st, int phase)
+{
+    double now = StatsClock();
+
+    if (st->phase != PP_NONE) st->time[st->phase] += now - st->start;
+
+    st->start = now;
+    st->phase = phase;
+}
+
+
+static mxArray *StatsToArray(CallStats *st)
+{
+    const char *fields[10] = {"windows", "abandoned", "hits_raw", "hits", "bytes_encoded",
+                              "time_encode", "time_scan", "time_resolve", "time_output", "time_cpu"};
+    mxArray *out;
+    int i;
+
+    StatsPhase(st, PP_NONE);
+
+    out = mxCreateStructMatrix(1, 1, 10, fields);
+
+    mxSetField(out, 0, "windows", mxCreateDoubleScalar((double)st->windows));
+    mxSetField(out, 0, "abandoned", mxCreateDoubleScalar((double)st->abandoned));
+    mxSetField(out, 0, "hits_raw", mxCreateDoubleScalar((double)st->hitsRaw));
+    mxSetField(out, 0, "hits", mxCreateDoubleScalar((double)st->hits));
+    mxSetField(out, 0, "bytes_encoded", mxCreateDoubleScalar((double)st->bytes));
+
+    for (i = 0; i < PP_NPHASE; i++)
+    {
+        mxSetField(out, 0, fields[5+i], mxCreateDoubleScalar(st->time[i]));
+    }
+
+    mxSetField(out, 0, "time_cpu", mxCreateDoubleScalar(STATS_CPU_TIME));
+
+    return out;
+}
+
+
+#endif
@@ -0,0 +1,18 @@
+/*=================================================================
+ *  cinline.h
+ *
+ *  lets the static inline helpers of shardio.h, mmindex.h, twobit.h
+ *  and hitbuf.h build in the C tools compiled as C89, which has no
+ *  inline keyword (GCC and MSVC both take __inline)
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef CINLINE_H
+#define CINLINE_H
+
+#if !defined(__cplusplus) && (!defined(__STDC_VERSION__) || __STDC_VERSION__ < 199901L) && !defined(inline)
+#define inline __inline
+#endif
+
+#endif
@@ -0,0 +1,413 @@
+/*=================================================================
+ *  fastagz.h
+ *
+ *  FASTA input layer shared by the native tools. Reads plain,
+ *  gzip and BGZF (bgzip) compressed FASTA files.
+ *
+ *  BGZF files are split into their independent deflate blocks which
+ *  are inflated by a pool of worker threads. Decoded blocks are handed
+ *  back to the calling thread strictly in file order so the FASTA
+ *  parser / encoders consume them while later blocks are still being
+ *  inflated. Plain gzip (and uncompressed) input falls back to a
+ *  single zlib stream.
+ *
+ *  No mex API calls are made from worker threads; errors are returned
+ *  as strings and raised by the caller.
+ *
+ *  link with -lz
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef FASTAGZ_H
+#define FASTAGZ_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <zlib.h>
+
+
+#define BGZF_MAX_BLOCK   65536
+#define GZ_CHUNK         (1 << 20)
+
+
+// receives decoded bytes in file order, returns false to stop reading
+
+typedef bool (*GzSink)(const char *data, size_t len, void *ctx);
+
+
+// a single FASTA record
+
+struct FastaRecord
+{
+    std::string header;
+    std::string sequence;
+};
+
+
+// incremental FASTA parser, fed with arbitrary sized pieces of text
+
+struct FastaParser
+{
+    std::vector<FastaRecord> *records;
+    bool inHeader;
+};
+
+
+static inline void FastaParserInit(FastaParser *fp, std::vector<FastaRecord> *records)
+{
+    fp->records = records;
+    fp->inHeader = false;
+}
+
+
+static inline bool FastaParserFeed(const char *data, size_t len, void *ctx)
+{
+    FastaParser *fp = (FastaParser*)ctx;
+    std::vector<FastaRecord> &rec = *fp->records;
+    size_t i, start;
+
+    i = 0;
+
+    while (i < len)
+    {
+        if (fp->inHeader)
+        {
+            start = i;
+            while (i < len && data[i] != '\n') i++;
+
+            rec.back().header.append(data + start, i - start);
+
+            if (i < len)
+            {
+                // strip trailing CR of DOS line endings
+
+                std::string &h = rec.back().header;
+                if (!h.empty() && h[h.size()-1] == '\r') h.erase(h.size()-1);
+                fp->inHeader = false;
+                i++;
+            }
+            continue;
+        }
+
+        if (data[i] == '>')
+        {
+            rec.push_back(FastaRecord());
+            fp->inHeader = true;
+            i++;
+            continue;
+        }
+
+        // sequence text, copy runs between whitespace in one go
+
+        start = i;
+        while (i < len && data[i] != '>' && data[i] != '\n' && data[i] != '\r'
+               && data[i] != ' ' && data[i] != '\t')
+        {
+            i++;
+        }
+
+        if (i > start)
+        {
+            if (rec.empty()) rec.push_back(FastaRecord());
+            rec.back().sequence.append(data + start, i - start);
+        }
+
+        if (i < len && data[i] != '>') i++;
+    }
+
+    return true;
+}
+
+
+
+// returns 1 if the file starts with a BGZF block header, 0 if not,
+// -1 if it cannot be opened
+
+static inline int IsBgzf(const char *fname)
+{
+    unsigned char h[18];
+    FILE *fid;
+    size_t n;
+
+    fid = fopen(fname, "rb");
+    if (fid == NULL) return -1;
+
+    n = fread(h, 1, 18, fid);
+    fclose(fid);
+
+    return (n == 18 && h[0] == 31 && h[1] == 139 && h[2] == 8 && (h[3] & 4)
+            && h[10] == 6 && h[11] == 0 && h[12] == 'B' && h[13] == 'C'
+            && h[14] == 2 && h[15] == 0) ? 1 : 0;
+}
+
+
+
+// single stream decoding for plain gzip and uncompressed files
+
+static inline std::string GzReadStream(const char *fname, GzSink sink, void *ctx)
+{
+    gzFile gz;
+    char *buf;
+    int n, err;
+    std::string msg;
+
+    gz = gzopen(fname, "rb");
+    if (gz == NULL) return std::string("cannot open ") + fname;
+
+    gzbuffer(gz, GZ_CHUNK);
+    buf = new char[GZ_CHUNK];
+
+    while ((n = gzread(gz, buf, GZ_CHUNK)) > 0)
+    {
+        if (!sink(buf, (size_t)n, ctx)) break;
+    }
+
+    if (n < 0) msg = gzerror(gz, &err);
+
+    gzclose(gz);
+    delete [] buf;
+
+    return msg;
+}
+
+
+
+// parallel BGZF decoding
+//
+// worker threads claim blocks in file order (reading the compressed
+// bytes under the lock), inflate them outside of it and the calling
+// thread consumes the decoded blocks in order. at most nslot blocks
+// are in flight, which bounds memory use to a few MB.
+
+struct BgzfSlot
+{
+    unsigned char cdata[BGZF_MAX_BLOCK];
+    char          udata[BGZF_MAX_BLOCK];
+    size_t        clen, ulen;
+    unsigned long crc;
+    bool          ready;
+};
+
+struct BgzfPipe
+{
+    FILE *fid;
+    std::vector<BgzfSlot> slots;
+    size_t nextRead, nextConsume;
+    bool eof, stop;
+    std::string err;
+    std::mutex lock;
+    std::condition_variable canRead, canConsume;
+};
+
+
+// read one block into slot, returns false at end of file or on error
+
+static inline bool BgzfReadBlock(BgzfPipe *p, BgzfSlot *s)
+{
+    unsigned char h[18], tail[8];
+    size_t bsize;
+
+    size_t n = fread(h, 1, 18, p->fid);
+
+    if (n == 0) return false;
+
+    if (n != 18 || h[0] != 31 || h[1] != 139 || !(h[3] & 4)
+        || h[12] != 'B' || h[13] != 'C' || h[10] != 6 || h[11] != 0)
+    {
+        p->err = "invalid BGZF block header";
+        return false;
+    }
+
+    bsize = (size_t)h[16] + ((size_t)h[17] << 8) + 1;
+
+    if (bsize < 26)
+    {
+        p->err = "invalid BGZF block size";
+        return false;
+    }
+
+    s->clen = bsize - 26;
+
+    if (fread(s->cdata, 1, s->clen, p->fid) != s->clen || fread(tail, 1, 8, p->fid) != 8)
+    {
+        p->err = "truncated BGZF block";
+        return false;
+    }
+
+    s->crc  = (unsigned long)tail[0] | ((unsigned long)tail[1] << 8)
+            | ((unsigned long)tail[2] << 16) | ((unsigned long)tail[3] << 24);
+    s->ulen = (size_t)tail[4] | ((size_t)tail[5] << 8)
+            | ((size_t)tail[6] << 16) | ((size_t)tail[7] << 24);
+
+    if (s->ulen > BGZF_MAX_BLOCK)
+    {
+        p->err = "invalid BGZF block size";
+        return false;
+    }
+
+    return true;
+}
+
+
+static inline bool BgzfInflate(BgzfSlot *s)
+{
+    z_stream zs;
+    int ret;
+
+    memset(&zs, 0, sizeof(zs));
+
+    if (inflateInit2(&zs, -15) != Z_OK) return false;
+
+    zs.next_in   = s->cdata;
+    zs.avail_in  = (uInt)s->clen;
+    zs.next_out  = (Bytef*)s->udata;
+    zs.avail_out = BGZF_MAX_BLOCK;
+
+    ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+
+    if (ret != Z_STREAM_END || zs.total_out != s->ulen) return false;
+
+    return crc32(crc32(0L, Z_NULL, 0), (const Bytef*)s->udata, (uInt)s->ulen) == s->crc;
+}
+
+
+static inline void BgzfWorker(BgzfPipe *p)
+{
+    BgzfSlot *s;
+
+    for (;;)
+    {
+        std::unique_lock<std::mutex> lk(p->lock);
+
+        p->canRead.wait(lk, [p] {
+            return p->eof || p->stop || p->nextRead - p->nextConsume < p->slots.size(); });
+
+        if (p->eof || p->stop) return;
+
+        s = &p->slots[p->nextRead % p->slots.size()];
+
+        if (!BgzfReadBlock(p, s))
+        {
+            p->eof = true;
+            p->canRead.notify_all();
+            p->canConsume.notify_all();
+            return;
+        }
+
+        p->nextRead++;
+        lk.unlock();
+
+        bool ok = BgzfInflate(s);
+
+        lk.lock();
+        if (!ok)
+        {
+            if (p->err.empty()) p->err = "corrupt BGZF block";
+            p->stop = true;
+            p->canRead.notify_all();
+        }
+        s->ready = true;
+        p->canConsume.notify_all();
+    }
+}
+
+
+static inline std::string BgzfReadParallel(const char *fname, GzSink sink, void *ctx, int nthreads)
+{
+    BgzfPipe p;
+    std::vector<std::thread> workers;
+    BgzfSlot *s;
+    size_t id;
+    int i;
+
+    if (nthreads < 1) nthreads = 1;
+
+    p.fid = fopen(fname, "rb");
+    if (p.fid == NULL) return std::string("cannot open ") + fname;
+
+    p.slots.resize(4*nthreads);
+    for (id = 0; id < p.slots.size(); id++) p.slots[id].ready = false;
+
+    p.nextRead = p.nextConsume = 0;
+    p.eof = p.stop = false;
+
+    for (i = 0; i < nthreads; i++)
+    {
+        workers.push_back(std::thread(BgzfWorker, &p));
+    }
+
+    // consume decoded blocks in file order
+
+    for (id = 0; ; id++)
+    {
+        std::unique_lock<std::mutex> lk(p.lock);
+
+        s = &p.slots[id % p.slots.size()];
+
+        p.canConsume.wait(lk, [&] {
+            return s->ready || p.stop || (p.eof && id >= p.nextRead); });
+
+        if (p.stop || !s->ready) break;
+
+        lk.unlock();
+
+        bool more = sink(s->udata, s->ulen, ctx);
+
+        lk.lock();
+        s->ready = false;
+        p.nextConsume++;
+        if (!more) p.stop = true;
+        p.canRead.notify_all();
+
+        if (!more) break;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(p.lock);
+        p.stop = true;
+        p.canRead.notify_all();
+    }
+
+    for (i = 0; i < nthreads; i++)
+    {
+        workers[i].join();
+    }
+
+    fclose(p.fid);
+
+    return p.err;
+}
+
+
+
+// read a FASTA file of any supported compression, returns an error
+// message or an empty string on success
+
+static inline std::string ReadFastaGz(const char *fname, std::vector<FastaRecord> *records, int nthreads)
+{
+    FastaParser fp;
+    int bgzf;
+
+    FastaParserInit(&fp, records);
+
+    bgzf = IsBgzf(fname);
+
+    if (bgzf < 0) return std::string("cannot open ") + fname;
+
+    if (bgzf == 1)
+    {
+        return BgzfReadParallel(fname, FastaParserFeed, &fp, nthreads);
+    }
+
+    return GzReadStream(fname, FastaParserFeed, &fp);
+}
+
+
+#endif
@@ -0,0 +1,100 @@
+/*=================================================================
+ *  fastagzread.cpp
+ *
+ *  seqs = fastagzread(filename)
+ *  seqs = fastagzread(filename,nthreads)
+ *
+ *  reads a FASTA file (.fa, .fa.gz or .fa.bgz) and returns a struct
+ *  array with fields Header and Sequence, as returned by fastaread
+ *
+ *  bgzip compressed files are inflated block-parallel on nthreads
+ *  worker threads (default: all cores) while the records are parsed,
+ *  plain gzip files are decoded as a single stream
+ *
+ *  compile with: mex fastagzread.cpp -lz
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include "mex.h"
+#include "fastagz.h"
+
+
+#define FNAME    prhs[0]
+#define NTH      prhs[1]
+#define OUT      plhs[0]
+
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *fname;
+    int     nthreads;
+    mwSize  iRec;
+    std::vector<FastaRecord> records;
+    std::string err;
+    const char *fields[2] = {"Header", "Sequence"};
+
+
+    // Check for correct number of arguments
+
+    if (nrhs < 1 || nrhs > 2)
+    {
+        mexErrMsgTxt("Usage: seqs = fastagzread(filename,nthreads)\n");
+    }
+    if (nlhs > 1)
+    {
+        mexErrMsgTxt("Usage: seqs = fastagzread(filename,nthreads)\n");
+    }
+
+    // Check to be sure inputs are correct
+
+    if (!(mxIsChar(FNAME)))
+    {
+        mexErrMsgTxt("filename must be of type string.\n.");
+    }
+
+    nthreads = (int)std::thread::hardware_concurrency();
+
+    if (nrhs == 2)
+    {
+        if (mxGetM(NTH) != 1 || mxGetN(NTH) != 1)
+        {
+            mexErrMsgTxt("nthreads must be a scalar.\n.");
+        }
+        nthreads = (int)mxGetScalar(NTH);
+    }
+
+    if (nthreads < 1) nthreads = 1;
+
+    fname = mxArrayToString(FNAME);
+
+
+    // Decode and parse
+
+    err = ReadFastaGz(fname, &records, nthreads);
+
+    mxFree(fname);
+
+    if (!err.empty())
+    {
+        mexErrMsgTxt((err + ".\n").c_str());
+    }
+
+
+    // Create output struct array
+
+    OUT = mxCreateStructMatrix(records.size(), 1, 2, fields);
+
+    for (iRec = 0; iRec < records.size(); iRec++)
+    {
+        mxSetField(OUT, iRec, "Header", mxCreateString(records[iRec].header.c_str()));
+        mxSetField(OUT, iRec, "Sequence", mxCreateString(records[iRec].sequence.c_str()));
+
+        std::string().swap(records[iRec].sequence);
+    }
+
+    return;
+}
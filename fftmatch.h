@@ -0,0 +1,218 @@
+/*=================================================================
+ *  fftmatch.h
+ *
+ *  FFT match counting engine for long motifs
+ *
+ *  the number of matching characters between a motif of length m and
+ *  every window of a sequence is the sum of four cross-correlations of
+ *  base indicator vectors (A, C, G, T). the indicators are packed in
+ *  pairs into complex signals (A + iC and G + iT, the reversed motif as
+ *  A - iC and G - iT) so that the real part of their convolution is the
+ *  sum of both correlations. one block therefore costs two forward and
+ *  one inverse FFT, done overlap-save over blocks of L >= 8m samples,
+ *  i.e. O(log m) work per window instead of O(m).
+ *
+ *  columns of a gapped motif that are masked out get zero indicators
+ *  and so match nothing, the counts are over the informative columns.
+ *
+ *  the engine only handles motifs made of upper case A, C, G and T;
+ *  any other character in the sequence matches nothing, which is what
+ *  a direct character compare gives for such a motif. callers fall
+ *  back to the direct kernel for other motifs and for motifs shorter
+ *  than FFT_MIN_MOTIF, where direct scoring is faster.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef FFTMATCH_H
+#define FFTMATCH_H
+
+#include <math.h>
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+#define FFT_MIN_MOTIF   64
+#define FFT_MIN_BLOCK   1024
+
+
+typedef std::complex<double> cplx;
+
+struct MatchEngine
+{
+    size_t m;                   // motif length
+    size_t L;                   // FFT block length (power of 2)
+    size_t step;                // windows produced per block, L-m+1
+    std::vector<cplx> W1, W2;   // spectra of the reversed motif indicators
+    std::vector<cplx> X1, X2;   // work buffers
+    std::vector<cplx> tw;       // twiddle factors
+    std::vector<size_t> rev;    // bit reversal permutation
+};
+
+
+// in-place radix-2 FFT of length e->L, inverse without the 1/L scaling
+
+static void Fft(MatchEngine *e, cplx *x, bool inverse)
+{
+    size_t i, j, k, len, half, tstep;
+    cplx t, w;
+
+    for (i = 0; i < e->L; i++)
+    {
+        j = e->rev[i];
+        if (i < j) std::swap(x[i], x[j]);
+    }
+
+    for (len = 2; len <= e->L; len <<= 1)
+    {
+        half = len >> 1;
+        tstep = e->L / len;
+
+        for (i = 0; i < e->L; i += len)
+        {
+            for (k = 0; k < half; k++)
+            {
+                w = e->tw[k*tstep];
+                if (inverse) w = std::conj(w);
+
+                t = w * x[i+k+half];
+                x[i+k+half] = x[i+k] - t;
+                x[i+k] += t;
+            }
+        }
+    }
+}
+
+
+// pack the A/C and G/T indicators of n characters into x1, x2.
+// sign = 1 for the sequence, -1 for the (reversed) motif
+
+static void PackIndicators(const char *s, size_t n, double sign, cplx *x1, cplx *x2)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        switch (s[i])
+        {
+            case 'A': x1[i] = cplx(1.0, 0.0);  break;
+            case 'C': x1[i] = cplx(0.0, sign); break;
+            case 'G': x2[i] = cplx(1.0, 0.0);  break;
+            case 'T': x2[i] = cplx(0.0, sign); break;
+        }
+    }
+}
+
+
+// true if the FFT engine should be used for a motif of length m
+// scanned over nwin windows
+
+static bool UseFftMatch(size_t m, size_t nwin)
+{
+    return m >= FFT_MIN_MOTIF && nwin >= 4*m;
+}
+
+
+// set up the engine for motif[0..m-1], returns false if the motif
+// contains anything but A, C, G and T. mask, if given, flags the
+// informative columns, the others may hold anything
+
+static bool MatchEngineInit(MatchEngine *e, const char *motif, size_t m, const bool *mask = NULL)
+{
+    std::vector<char> r(m);
+    size_t i, bits;
+
+    for (i = 0; i < m; i++)
+    {
+        if (mask != NULL && !mask[m-1-i])
+        {
+            r[i] = 0;
+            continue;
+        }
+        if (motif[m-1-i] != 'A' && motif[m-1-i] != 'C' && motif[m-1-i] != 'G' && motif[m-1-i] != 'T') return false;
+        r[i] = motif[m-1-i];
+    }
+
+    e->m = m;
+    e->L = FFT_MIN_BLOCK;
+    while (e->L < 8*m) e->L <<= 1;
+    e->step = e->L - m + 1;
+
+    for (bits = 0; ((size_t)1 << bits) < e->L; bits++);
+
+    e->rev.resize(e->L);
+    e->tw.resize(e->L/2);
+
+    for (i = 0; i < e->L; i++)
+    {
+        e->rev[i] = (e->rev[i>>1] >> 1) | ((i & 1) << (bits-1));
+    }
+
+    for (i = 0; i < e->L/2; i++)
+    {
+        e->tw[i] = std::polar(1.0, -2.0*M_PI*(double)i/(double)e->L);
+    }
+
+    e->W1.assign(e->L, cplx(0.0, 0.0));
+    e->W2.assign(e->L, cplx(0.0, 0.0));
+    e->X1.resize(e->L);
+    e->X2.resize(e->L);
+
+    PackIndicators(&r[0], m, -1.0, &e->W1[0], &e->W2[0]);
+
+    Fft(e, &e->W1[0], false);
+    Fft(e, &e->W2[0], false);
+
+    return true;
+}
+
+
+// match counts of the windows starting at iFirst, iFirst+1, ... of
+// seq[0..n-1] into counts. stops at window iEnd (exclusive) or after
+// e->step windows, returns the number of windows done
+
+static size_t MatchCounts(MatchEngine *e, const char *seq, size_t n, size_t iFirst, size_t iEnd, int *counts)
+{
+    size_t i, nIn, nOut;
+    double scale;
+
+    nOut = iEnd - iFirst;
+    if (nOut > e->step) nOut = e->step;
+
+    nIn = nOut + e->m - 1;
+    if (iFirst + nIn > n) nIn = n - iFirst;
+
+    std::fill(e->X1.begin(), e->X1.end(), cplx(0.0, 0.0));
+    std::fill(e->X2.begin(), e->X2.end(), cplx(0.0, 0.0));
+
+    PackIndicators(seq + iFirst, nIn, 1.0, &e->X1[0], &e->X2[0]);
+
+    Fft(e, &e->X1[0], false);
+    Fft(e, &e->X2[0], false);
+
+    for (i = 0; i < e->L; i++)
+    {
+        e->X1[i] = e->X1[i]*e->W1[i] + e->X2[i]*e->W2[i];
+    }
+
+    Fft(e, &e->X1[0], true);
+
+    // circular wrap only affects the first m-1 outputs (overlap-save)
+
+    scale = 1.0/(double)e->L;
+
+    for (i = 0; i < nOut; i++)
+    {
+        counts[i] = (int)floor(e->X1[i + e->m - 1].real()*scale + 0.5);
+    }
+
+    return nOut;
+}
+
+
+#endif
@@ -0,0 +1,147 @@
+/*=================================================================
+ *  hitbuf.h
+ *
+ *  hit list of the motifind tools and shardmerge: 1-based positions
+ *  (64-bit) and optionally the strand and score of each hit
+ *
+ *  hits are kept in chunks of HIT_CHUNK that are allocated as the list
+ *  grows and never moved, so nothing the size of seq1 is allocated up
+ *  front and no doubling copy is made. the chunks are copied once into
+ *  the outputs: positions as a 1 x n int64 row (exact at any genome
+ *  size), strand and score as double rows.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef HITBUF_H
+#define HITBUF_H
+
+#include <string.h>
+#include "mex.h"
+#include "cinline.h"
+
+#define HIT_CHUNK   65536
+
+
+typedef struct
+{
+    long long n;                /* hits stored */
+    int       nChunk, maxChunk;
+    int       withScore;        /* strand and score are kept */
+    long long **pos;
+    double    **strand, **score;
+} HitBuf;
+
+
+static inline void HitInit(HitBuf *h, int withScore)
+{
+    memset(h, 0, sizeof(*h));
+    h->withScore = withScore;
+}
+
+
+static inline void HitAdd(HitBuf *h, long long pos, double strand, double score)
+{
+    long long i = h->n % HIT_CHUNK;
+
+    if (i == 0)
+    {
+        if (h->nChunk == h->maxChunk)
+        {
+            h->maxChunk = h->maxChunk ? 2*h->maxChunk : 16;
+            h->pos = (long long**)mxRealloc(h->pos, h->maxChunk*sizeof(long long*));
+            h->strand = (double**)mxRealloc(h->strand, h->maxChunk*sizeof(double*));
+            h->score = (double**)mxRealloc(h->score, h->maxChunk*sizeof(double*));
+        }
+
+        h->pos[h->nChunk] = (long long*)mxMalloc(HIT_CHUNK*sizeof(long long));
+
+        if (h->withScore)
+        {
+            h->strand[h->nChunk] = (double*)mxMalloc(HIT_CHUNK*sizeof(double));
+            h->score[h->nChunk] = (double*)mxMalloc(HIT_CHUNK*sizeof(double));
+        }
+
+        h->nChunk++;
+    }
+
+    h->pos[h->nChunk-1][i] = pos;
+
+    if (h->withScore)
+    {
+        h->strand[h->nChunk-1][i] = strand;
+        h->score[h->nChunk-1][i] = score;
+    }
+
+    h->n++;
+}
+
+
+/* copies one column of chunks into dst */
+
+static inline void HitCopy(const HitBuf *h, void **chunk, size_t size, char *dst)
+{
+    long long done, len;
+    int c;
+
+    for (c = 0, done = 0; c < h->nChunk; c++, done += len)
+    {
+        len = (h->n - done < HIT_CHUNK) ? h->n - done : HIT_CHUNK;
+        memcpy(dst + done*size, chunk[c], len*size);
+    }
+}
+
+
+static inline mxArray *HitPositions(const HitBuf *h)
+{
+    mxArray *out = mxCreateNumericMatrix(1, (mwSize)h->n, mxINT64_CLASS, mxREAL);
+
+    HitCopy(h, (void**)h->pos, sizeof(long long), (char*)mxGetData(out));
+
+    return out;
+}
+
+
+static inline mxArray *HitStrands(const HitBuf *h)
+{
+    mxArray *out = mxCreateDoubleMatrix(1, (mwSize)h->n, mxREAL);
+
+    HitCopy(h, (void**)h->strand, sizeof(double), (char*)mxGetPr(out));
+
+    return out;
+}
+
+
+static inline mxArray *HitScores(const HitBuf *h)
+{
+    mxArray *out = mxCreateDoubleMatrix(1, (mwSize)h->n, mxREAL);
+
+    HitCopy(h, (void**)h->score, sizeof(double), (char*)mxGetPr(out));
+
+    return out;
+}
+
+
+static inline void HitFree(HitBuf *h)
+{
+    int c;
+
+    for (c = 0; c < h->nChunk; c++)
+    {
+        mxFree(h->pos[c]);
+
+        if (h->withScore)
+        {
+            mxFree(h->strand[c]);
+            mxFree(h->score[c]);
+        }
+    }
+
+    mxFree(h->pos);
+    mxFree(h->strand);
+    mxFree(h->score);
+    memset(h, 0, sizeof(*h));
+}
+
+
+#endif
@@ -0,0 +1,112 @@
+/*=================================================================
+ *  identtrack.cpp
+ *
+ *  track = identtrack(seq1,seq2)
+ *
+ *  returns the fraction of characters seq2 has in common with the
+ *  window of seq1 starting at every position, as a single precision
+ *  1 x (length(seq1)-length(seq2)+1) vector. the per-position track
+ *  behind motifind, without threshold or overlap removal.
+ *
+ *  motifs of FFT_MIN_MOTIF or more bases are scored with the FFT
+ *  match counting engine (fftmatch.h), shorter ones directly
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h> /* strlen */
+#include "mex.h"
+#include "fftmatch.h"
+
+
+#define OUT     plhs[0]
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *str1, *str2;
+    mwSize  lSt1, lSt2, iPos, iCh, iLast, iBlk, nBlk, score;
+    int     *counts;
+    float   *track;
+    MatchEngine eng;
+
+
+    // Check for correct number of arguments
+
+    if (nrhs != 2)
+    {
+        mexErrMsgTxt("Usage: track = identtrack(seq1,seq2)\n");
+    }
+    if (nlhs > 1)
+    {
+        mexErrMsgTxt("Usage: track = identtrack(seq1,seq2)\n");
+    }
+
+    // Check to be sure inputs are correct
+
+    if (!(mxIsChar(prhs[0])) || !(mxIsChar(prhs[1])))
+    {
+        mexErrMsgTxt("seq1 and seq2 must be of type string.\n.");
+    }
+
+    str1=mxArrayToString(prhs[0]);
+    str2=mxArrayToString(prhs[1]);
+
+    lSt1 = strlen(str1);
+    lSt2 = strlen(str2);
+
+    if (lSt1 < lSt2 || lSt2 == 0)
+    {
+        mxFree(str1);
+        mxFree(str2);
+        mexErrMsgTxt("Length of str1 must be longer than or equal to length of str2 > 0.\n");
+    }
+
+    iLast = (lSt1 - lSt2 + 1);
+
+    OUT = mxCreateNumericMatrix(1, iLast, mxSINGLE_CLASS, mxREAL);
+    track = (float*)mxGetData(OUT);
+
+
+    // Long motifs by FFT, a block of windows at a time
+
+    if (UseFftMatch(lSt2, iLast) && MatchEngineInit(&eng, str2, lSt2))
+    {
+        counts = (int*)mxCalloc(eng.step,sizeof(int));
+
+        for (iBlk = 0; iBlk < iLast; iBlk += nBlk)
+        {
+            nBlk = MatchCounts(&eng, str1, lSt1, iBlk, iLast, counts);
+
+            for (iPos = 0; iPos < nBlk; iPos++)
+            {
+                track[iBlk+iPos] = (float)((double)counts[iPos]/(double)lSt2);
+            }
+        }
+
+        mxFree(counts);
+    }
+    else
+    {
+        for (iPos = 0; iPos < iLast; iPos++)
+        {
+            score = 0;
+
+            for (iCh = 0; iCh < lSt2; iCh++)
+            {
+                if (str1[iCh+iPos] == str2[iCh])
+                {
+                    score++;
+                }
+            }
+
+            track[iPos] = (float)((double)score/(double)lSt2);
+        }
+    }
+
+    mxFree(str1);
+    mxFree(str2);
+
+    return;
+}
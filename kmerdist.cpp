@@ -0,0 +1,340 @@
+/*=================================================================
+ *  kmerdist.cpp
+ *
+ *  D = kmerdist(seqs,motif_size,metric)
+ *  D = kmerdist(seqs,motif_size,metric,nthreads)
+ *
+ *  returns the single precision n x n matrix of pairwise distances
+ *  between the k-mer profiles of the n sequences in cell array seqs
+ *  (similarities for 'd2', see below)
+ *
+ *  a profile holds the motifcount counts of every word of length
+ *  (motif_size) occurring in the sequence: reverse compliments counted
+ *  together, overlapping words counted as 1. words containing anything
+ *  but A, C, G, T are skipped. motif_size may be up to 31.
+ *
+ *  metric is one of
+ *      'cosine'   1 - cosine of the angle between the count vectors
+ *      'jaccard'  1 - |A & B| / |A | B| of the sets of words present
+ *      'd2'       the D2 statistic, the dot product of the counts.
+ *                 this is a similarity, not a distance: larger means
+ *                 more alike and the diagonal holds each sequence's
+ *                 sum of squared counts, not 0
+ *
+ *  profiles are kept sparse (sorted word codes and counts). the
+ *  matrix is computed in tiles of TILE x TILE sequences, handed out
+ *  to nthreads worker threads (default: all cores), so the profiles
+ *  of a tile stay in cache while all its pairs are merged.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include "mex.h"
+
+
+#define SEQS     prhs[0]
+#define MS       prhs[1]
+#define MET      prhs[2]
+#define NTH      prhs[3]
+#define OUT      plhs[0]
+#define MAX      31
+#define TILE     64
+
+enum { COSINE, JACCARD, D2 };
+
+
+// sparse k-mer profile of one sequence
+
+struct Profile
+{
+    std::vector<uint64_t> code;
+    std::vector<double>   count;
+    double norm;
+};
+
+
+// canonical codes (motifcount base order A T C G, complement = code^1)
+// of every word, counted with the non-overlap rule
+
+void BuildProfile(const char *str, int smotif, Profile *prof)
+{
+    std::vector<std::pair<uint64_t,int64_t> > words;
+    uint64_t fwd, rev, mask, num, code;
+    int64_t iPos, run, next;
+    size_t i;
+
+    mask = ((uint64_t)1 << (2*smotif)) - 1;
+    fwd = rev = 0;
+    run = 0;
+
+    for (iPos = 0; str[iPos] != 0; iPos++)
+    {
+        switch (str[iPos])
+        {
+            case 'A': num = 0; break;
+            case 'T': num = 1; break;
+            case 'C': num = 2; break;
+            case 'G': num = 3; break;
+            default:  run = 0; continue;
+        }
+
+        fwd = ((fwd << 2) | num) & mask;
+        rev = (rev >> 2) | ((num^1) << (2*(smotif-1)));
+        run++;
+
+        if (run >= smotif)
+        {
+            words.push_back(std::make_pair(rev < fwd ? rev : fwd, iPos - smotif + 1));
+        }
+    }
+
+    // group by word, keeping positions in order, then drop overlaps
+
+    std::sort(words.begin(), words.end());
+
+    prof->code.clear();
+    prof->count.clear();
+    prof->norm = 0.0;
+
+    for (i = 0; i < words.size(); )
+    {
+        code = words[i].first;
+        next = words[i].second + smotif;
+        prof->code.push_back(code);
+        prof->count.push_back(1.0);
+
+        for (i++; i < words.size() && words[i].first == code; i++)
+        {
+            if (words[i].second < next) continue;
+            prof->count.back() += 1.0;
+            next = words[i].second + smotif;
+        }
+
+        prof->norm += prof->count.back()*prof->count.back();
+    }
+
+    prof->norm = sqrt(prof->norm);
+}
+
+
+// distance between two profiles, merging the sorted word lists
+
+float ProfileDist(const Profile *a, const Profile *b, int metric)
+{
+    size_t i, j, na, nb, nboth;
+    uint64_t x, y;
+    double dot;
+
+    na = a->code.size();
+    nb = b->code.size();
+    i = j = nboth = 0;
+    dot = 0.0;
+
+    // i and j step by the results of the comparisons instead of a
+    // branch on which word is smaller, whose outcome is unpredictable;
+    // only equal words take a branch
+
+    while (i < na && j < nb)
+    {
+        x = a->code[i];
+        y = b->code[j];
+
+        if (x == y)
+        {
+            dot += a->count[i]*b->count[j];
+            nboth++;
+        }
+
+        i += (x <= y);
+        j += (y <= x);
+    }
+
+    switch (metric)
+    {
+        case COSINE:
+            if (a->norm == 0.0 || b->norm == 0.0) return (float)NAN;
+            return (float)(1.0 - dot/(a->norm*b->norm));
+
+        case JACCARD:
+            if (na + nb == 0) return (float)NAN;
+            return (float)(1.0 - (double)nboth/(double)(na + nb - nboth));
+
+        default:
+            return (float)dot;
+    }
+}
+
+
+// workers: profiles are built one sequence at a time, then the upper
+// triangle of the matrix is filled one tile at a time
+
+struct DistJob
+{
+    char **str;
+    int  nSeq, smotif, metric, nTile;
+    std::vector<Profile> prof;
+    std::atomic<int> nextSeq, nextTile;
+    float *dist;
+};
+
+void DistWorker(DistJob *job)
+{
+    int iSeq;
+
+    while ((iSeq = job->nextSeq++) < job->nSeq)
+    {
+        BuildProfile(job->str[iSeq], job->smotif, &job->prof[iSeq]);
+    }
+}
+
+void TileWorker(DistJob *job)
+{
+    int iTile, iBlk, jBlk, i, j, iEnd, jEnd, nBlk;
+    float dij;
+
+    nBlk = (job->nSeq + TILE - 1)/TILE;
+
+    while ((iTile = job->nextTile++) < job->nTile)
+    {
+        // tile index -> (iBlk, jBlk) with iBlk <= jBlk
+
+        iBlk = 0;
+        jBlk = iTile;
+        while (jBlk >= nBlk - iBlk)
+        {
+            jBlk -= nBlk - iBlk;
+            iBlk++;
+        }
+        jBlk += iBlk;
+
+        iEnd = std::min((iBlk+1)*TILE, job->nSeq);
+        jEnd = std::min((jBlk+1)*TILE, job->nSeq);
+
+        for (i = iBlk*TILE; i < iEnd; i++)
+        {
+            for (j = (iBlk == jBlk) ? i : jBlk*TILE; j < jEnd; j++)
+            {
+                dij = ProfileDist(&job->prof[i], &job->prof[j], job->metric);
+                job->dist[(size_t)j*job->nSeq + i] = dij;
+                job->dist[(size_t)i*job->nSeq + j] = dij;
+            }
+        }
+    }
+}
+
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    metric[16];
+    int     nSeq, iSeq, nthreads, i, nBlk;
+    DistJob job;
+    std::vector<std::thread> workers;
+
+
+    // Check for correct number of arguments
+
+    if (nrhs < 3 || nrhs > 4)
+    {
+        mexErrMsgTxt("Usage: D = kmerdist(seqs,motif_size,metric,nthreads)\n");
+    }
+    if (nlhs > 1)
+    {
+        mexErrMsgTxt("Usage: D = kmerdist(seqs,motif_size,metric,nthreads)\n");
+    }
+
+    // Check to be sure inputs are correct
+
+    if (!mxIsCell(SEQS))
+    {
+        mexErrMsgTxt("seqs must be a cell array of strings.\n.");
+    }
+
+    if (mxGetNumberOfElements(MS) != 1)
+    {
+        mexErrMsgTxt("motif_size must be a scalar.\n.");
+    }
+
+    job.smotif = (int)mxGetScalar(MS);
+
+    if (job.smotif < 1 || job.smotif > MAX)
+    {
+        mexErrMsgTxt("motif_size must be 1..31.\n.");
+    }
+
+    if (!mxIsChar(MET) || mxGetString(MET, metric, sizeof(metric)) != 0)
+    {
+        mexErrMsgTxt("metric must be 'cosine', 'jaccard' or 'd2'.\n.");
+    }
+
+    if (strcmp(metric, "cosine") == 0)       job.metric = COSINE;
+    else if (strcmp(metric, "jaccard") == 0) job.metric = JACCARD;
+    else if (strcmp(metric, "d2") == 0)      job.metric = D2;
+    else mexErrMsgTxt("metric must be 'cosine', 'jaccard' or 'd2'.\n.");
+
+    nthreads = (int)std::thread::hardware_concurrency();
+
+    if (nrhs == 4)
+    {
+        if (mxGetNumberOfElements(NTH) != 1)
+        {
+            mexErrMsgTxt("nthreads must be a scalar.\n.");
+        }
+        nthreads = (int)mxGetScalar(NTH);
+    }
+
+    if (nthreads < 1) nthreads = 1;
+
+    nSeq = (int)mxGetNumberOfElements(SEQS);
+
+    // strings are fetched here, workers must not call the mex API
+
+    job.str = (char**)mxCalloc(nSeq > 0 ? nSeq : 1, sizeof(char*));
+
+    for (iSeq = 0; iSeq < nSeq; iSeq++)
+    {
+        if (mxGetCell(SEQS,iSeq) == NULL || !mxIsChar(mxGetCell(SEQS,iSeq)))
+        {
+            mexErrMsgTxt("seqs must be a cell array of strings.\n.");
+        }
+        job.str[iSeq] = mxArrayToString(mxGetCell(SEQS,iSeq));
+    }
+
+    OUT = mxCreateNumericMatrix(nSeq, nSeq, mxSINGLE_CLASS, mxREAL);
+
+    job.nSeq = nSeq;
+    job.dist = (float*)mxGetData(OUT);
+    job.prof.resize(nSeq);
+    job.nextSeq = 0;
+    job.nextTile = 0;
+
+    nBlk = (nSeq + TILE - 1)/TILE;
+    job.nTile = nBlk*(nBlk + 1)/2;
+
+
+    // Build profiles, then fill the matrix tile by tile
+
+    for (i = 0; i < nthreads; i++) workers.push_back(std::thread(DistWorker, &job));
+    for (i = 0; i < nthreads; i++) workers[i].join();
+
+    workers.clear();
+
+    for (i = 0; i < nthreads; i++) workers.push_back(std::thread(TileWorker, &job));
+    for (i = 0; i < nthreads; i++) workers[i].join();
+
+    for (iSeq = 0; iSeq < nSeq; iSeq++)
+    {
+        mxFree(job.str[iSeq]);
+    }
+    mxFree(job.str);
+
+    return;
+}
@@ -0,0 +1,129 @@
+/*=================================================================
+ *  mmindex.cpp
+ *
+ *  index = mmindex(seq1,k,w)
+ *
+ *  returns a minimizer index of seq1 for seeding motifind and
+ *  subseqcount (see mmindex.h): a struct with fields
+ *
+ *      k, w    k-mer and window length (k <= 16)
+ *      n       length of seq1
+ *      code    uint32 codes of the (w,k)-minimizers, ascending
+ *      pos     1-based positions of the minimizers, uint32 or for
+ *              sequences of 2^32 bases or more uint64
+ *
+ *  about 2/(w+1) of the positions of seq1 are stored, 8 bytes each
+ *  (12 with uint64 positions).
+ *  searches are exact while floor((m-e)/(e+1)) >= w+k-1 for a motif of
+ *  length m and e allowed mismatches, so smaller k and w seed lower
+ *  identities at the cost of a larger index.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h> /* strlen */
+#include <algorithm>
+#include <vector>
+#include "mex.h"
+#include "mmindex.h"
+
+
+#define SEQ     prhs[0]
+#define KMER    prhs[1]
+#define WIN     prhs[2]
+#define OUT     plhs[0]
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *str;
+    int     k, w;
+    mwSize  lSeq, nSeed, iSeed;
+    unsigned int *code;
+    unsigned long long *pos;
+    const char *fields[5] = {"k", "w", "n", "code", "pos"};
+    mxArray *mxCode, *mxPos;
+    std::vector<std::pair<unsigned int, unsigned long long> > seeds;
+    bool    wide;
+
+
+    // Check for correct number of arguments
+
+    if (nrhs != 3)
+    {
+        mexErrMsgTxt("Usage: index = mmindex(seq1,k,w)\n");
+    }
+    if (nlhs > 1)
+    {
+        mexErrMsgTxt("Usage: index = mmindex(seq1,k,w)\n");
+    }
+
+    // Check to be sure inputs are correct
+
+    if (!(mxIsChar(SEQ)))
+    {
+        mexErrMsgTxt("seq1 must be of type string.\n.");
+    }
+
+    if (mxGetNumberOfElements(KMER) != 1 || mxGetNumberOfElements(WIN) != 1)
+    {
+        mexErrMsgTxt("k and w must be scalars.\n.");
+    }
+
+    k = (int)mxGetScalar(KMER);
+    w = (int)mxGetScalar(WIN);
+
+    if (k < 1 || k > MM_MAXK || w < 1)
+    {
+        mexErrMsgTxt("k must be 1..16 and w >= 1.\n.");
+    }
+
+    str = mxArrayToString(SEQ);
+    lSeq = strlen(str);
+
+    wide = (lSeq >= 0xffffffffu);
+
+
+    // Minimizers in position order, then sorted by code
+
+    nSeed = MmSketch(str, lSeq, k, w, NULL, NULL);
+
+    mxCode = mxCreateNumericMatrix(nSeed, 1, mxUINT32_CLASS, mxREAL);
+    mxPos = mxCreateNumericMatrix(nSeed, 1, wide ? mxUINT64_CLASS : mxUINT32_CLASS, mxREAL);
+    code = (unsigned int*)mxGetData(mxCode);
+    pos = (unsigned long long*)mxCalloc(nSeed + 1, sizeof(unsigned long long));
+
+    MmSketch(str, lSeq, k, w, code, pos);
+
+    seeds.resize(nSeed);
+
+    for (iSeed = 0; iSeed < nSeed; iSeed++)
+    {
+        seeds[iSeed] = std::make_pair(code[iSeed], pos[iSeed]);
+    }
+
+    std::sort(seeds.begin(), seeds.end());
+
+    for (iSeed = 0; iSeed < nSeed; iSeed++)
+    {
+        code[iSeed] = seeds[iSeed].first;
+
+        if (wide) ((unsigned long long*)mxGetData(mxPos))[iSeed] = seeds[iSeed].second;
+        else ((unsigned int*)mxGetData(mxPos))[iSeed] = (unsigned int)seeds[iSeed].second;
+    }
+
+    mxFree(pos);
+
+    OUT = mxCreateStructMatrix(1, 1, 5, fields);
+
+    mxSetField(OUT, 0, "k", mxCreateDoubleScalar(k));
+    mxSetField(OUT, 0, "w", mxCreateDoubleScalar(w));
+    mxSetField(OUT, 0, "n", mxCreateDoubleScalar((double)lSeq));
+    mxSetField(OUT, 0, "code", mxCode);
+    mxSetField(OUT, 0, "pos", mxPos);
+
+    mxFree(str);
+
+    return;
+}
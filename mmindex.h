@@ -0,0 +1,324 @@
+/*=================================================================
+ *  mmindex.h
+ *
+ *  minimizer index of a reference sequence, built by mmindex and used
+ *  by motifind and subseqcount to seed approximate searches
+ *
+ *  the (w,k)-minimizers of a sequence are, for every run of w
+ *  consecutive k-mers, the k-mer(s) with the smallest hash. only these
+ *  are stored, roughly 2/(w+1) of all positions, as a list of k-mer
+ *  codes (A C G T = 0..3, 2 bits per base) and 1-based positions
+ *  sorted by code. k-mers containing anything but upper case A, C, G,
+ *  T are never stored.
+ *
+ *  seeding is exact: a window with at most e mismatches against a
+ *  motif of length m has an exact run of floor((m-e)/(e+1)) bases in
+ *  common with it. if that is at least w+k-1 the run contains a full
+ *  minimizer window, whose minimizer is stored for both the motif and
+ *  the reference (ties are all stored). every window passing the
+ *  identity threshold is therefore among the candidates, which are
+ *  verified with the usual identity test. MmUsable tells whether the
+ *  guarantee holds, callers scan exhaustively otherwise.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef MMINDEX_H
+#define MMINDEX_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "mex.h"
+#include "cinline.h"
+
+#define MM_MAXK     16
+#define MM_NOHASH   0x100000000ULL
+
+
+typedef struct
+{
+    int k;                      /* k-mer length */
+    int w;                      /* k-mers per minimizer window */
+    mwSize n;                   /* length of the indexed sequence */
+    mwSize nseed;               /* number of minimizers stored */
+    const unsigned int *code;   /* k-mer codes, ascending */
+    const unsigned int *pos32;  /* 1-based positions, ascending per code, */
+    const unsigned long long *pos64;  /* uint32 or uint64 (one is NULL) */
+} MmIndex;
+
+
+static inline unsigned long long MmPos(const MmIndex *idx, mwSize i)
+{
+    return idx->pos32 != NULL ? idx->pos32[i] : idx->pos64[i];
+}
+
+
+static inline int MmBase(char c)
+{
+    switch (c)
+    {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default:  return -1;
+    }
+}
+
+
+/* order of k-mers, scrambled so that low complexity words like
+   AAAA... are not always the minimizers */
+
+static inline unsigned long long MmHash(unsigned int code)
+{
+    code = (code ^ (code >> 16)) * 0x45d9f3bu;
+    code = (code ^ (code >> 16)) * 0x45d9f3bu;
+    code = code ^ (code >> 16);
+
+    return (unsigned long long)code;
+}
+
+
+/* minimizers of s[0..n-1] in position order. with code == NULL they
+   are only counted. returns the number of minimizers */
+
+static inline mwSize MmSketch(const char *s, mwSize n, int k, int w,
+                              unsigned int *code, unsigned long long *pos)
+{
+    unsigned long long *qHash, h, hMin;
+    unsigned int *qCode, fwd, mask;
+    mwSize *qPos, i, iKmer, lastPos, nSeed;
+    int head, tail, cnt, cap, run, num, j, q;
+
+    /* ring buffer, holds the window plus the k-mer entering it */
+
+    cap = w + 1;
+    qHash = (unsigned long long*)mxCalloc(cap, sizeof(unsigned long long));
+    qCode = (unsigned int*)mxCalloc(cap, sizeof(unsigned int));
+    qPos = (mwSize*)mxCalloc(cap, sizeof(mwSize));
+
+    mask = (k == 16) ? 0xffffffffu : ((1u << (2*k)) - 1);
+    fwd = 0;
+    run = 0;
+    head = tail = cnt = 0;
+    lastPos = (mwSize)-1;
+    nSeed = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        num = MmBase(s[i]);
+
+        if (num < 0)
+        {
+            run = 0;
+            num = 0;
+        }
+        else
+        {
+            run++;
+        }
+
+        fwd = ((fwd << 2) | (unsigned int)num) & mask;
+
+        if (i + 1 < (mwSize)k) continue;
+
+        iKmer = i + 1 - k;
+        h = (run >= k) ? MmHash(fwd) : MM_NOHASH;
+
+        /* monotone queue of the window, equal hashes are kept so that
+           all ties of the minimum sit at the front */
+
+        while (cnt > 0 && qHash[(tail + cap - 1) % cap] > h)
+        {
+            tail = (tail + cap - 1) % cap;
+            cnt--;
+        }
+
+        qHash[tail] = h;
+        qCode[tail] = fwd;
+        qPos[tail] = iKmer;
+        tail = (tail + 1) % cap;
+        cnt++;
+
+        while (qPos[head] + w <= iKmer)
+        {
+            head = (head + 1) % cap;
+            cnt--;
+        }
+
+        if (iKmer + 1 < (mwSize)w) continue;
+
+        hMin = qHash[head];
+        if (hMin == MM_NOHASH) continue;
+
+        for (j = 0, q = head; j < cnt && qHash[q] == hMin; j++, q = (q + 1) % cap)
+        {
+            if (lastPos != (mwSize)-1 && qPos[q] <= lastPos) continue;
+
+            if (code != NULL)
+            {
+                code[nSeed] = qCode[q];
+                pos[nSeed] = (unsigned long long)qPos[q] + 1;
+            }
+
+            lastPos = qPos[q];
+            nSeed++;
+        }
+    }
+
+    mxFree(qHash);
+    mxFree(qCode);
+    mxFree(qPos);
+
+    return nSeed;
+}
+
+
+/* read an index struct made by mmindex, returns an error message or
+   NULL */
+
+static inline const char *MmIndexFromArray(const mxArray *a, MmIndex *idx)
+{
+    const mxArray *f[5];
+    const char *names[5] = {"k", "w", "n", "code", "pos"};
+    int i;
+
+    if (!mxIsStruct(a) || mxGetNumberOfElements(a) != 1)
+    {
+        return "index must be a struct made by mmindex.\n.";
+    }
+
+    for (i = 0; i < 5; i++)
+    {
+        f[i] = mxGetField(a, 0, names[i]);
+        if (f[i] == NULL) return "index must be a struct made by mmindex.\n.";
+    }
+
+    if (mxGetClassID(f[3]) != mxUINT32_CLASS
+        || (mxGetClassID(f[4]) != mxUINT32_CLASS && mxGetClassID(f[4]) != mxUINT64_CLASS)
+        || mxGetNumberOfElements(f[3]) != mxGetNumberOfElements(f[4]))
+    {
+        return "index must be a struct made by mmindex.\n.";
+    }
+
+    idx->k = (int)mxGetScalar(f[0]);
+    idx->w = (int)mxGetScalar(f[1]);
+    idx->n = (mwSize)mxGetScalar(f[2]);
+    idx->nseed = mxGetNumberOfElements(f[3]);
+    idx->code = (const unsigned int*)mxGetData(f[3]);
+    idx->pos32 = NULL;
+    idx->pos64 = NULL;
+
+    if (mxGetClassID(f[4]) == mxUINT32_CLASS) idx->pos32 = (const unsigned int*)mxGetData(f[4]);
+    else idx->pos64 = (const unsigned long long*)mxGetData(f[4]);
+
+    if (idx->k < 1 || idx->k > MM_MAXK || idx->w < 1)
+    {
+        return "index must be a struct made by mmindex.\n.";
+    }
+
+    return NULL;
+}
+
+
+/* true if every window of the m bases of motif with score >= pct is
+   guaranteed to be seeded by idx */
+
+static inline int MmUsable(const MmIndex *idx, const char *motif, mwSize m, double pct)
+{
+    mwSize i, nMatch, nMis;
+
+    for (i = 0; i < m; i++)
+    {
+        if (MmBase(motif[i]) < 0) return 0;
+    }
+
+    /* fewest matching characters that pass, same test as the scanners */
+
+    for (nMatch = 0; nMatch < m; nMatch++)
+    {
+        if ((double)nMatch/(double)m >= pct) break;
+    }
+
+    nMis = m - nMatch;
+
+    return (m - nMis)/(nMis + 1) >= (mwSize)(idx->w + idx->k - 1);
+}
+
+
+static inline int MmCompareSize(const void *a, const void *b)
+{
+    mwSize x = *(const mwSize*)a, y = *(const mwSize*)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* candidate window starts (0-based, ascending, no duplicates) of the
+   motif among the iLast windows of the indexed sequence. *cand is
+   allocated with mxMalloc, returns the number of candidates */
+
+static inline mwSize MmCandidates(const MmIndex *idx, const char *motif, mwSize m,
+                                  mwSize iLast, mwSize **cand)
+{
+    unsigned int *mCode;
+    unsigned long long *mPos;
+    mwSize nMot, iMot, lo, hi, mid, nCand, maxCand, i, j, off, p;
+
+    nMot = MmSketch(motif, m, idx->k, idx->w, NULL, NULL);
+
+    mCode = (unsigned int*)mxCalloc(nMot + 1, sizeof(unsigned int));
+    mPos = (unsigned long long*)mxCalloc(nMot + 1, sizeof(unsigned long long));
+
+    MmSketch(motif, m, idx->k, idx->w, mCode, mPos);
+
+    maxCand = 1024;
+    nCand = 0;
+    *cand = (mwSize*)mxMalloc(maxCand*sizeof(mwSize));
+
+    for (iMot = 0; iMot < nMot; iMot++)
+    {
+        /* first entry with this code */
+
+        lo = 0;
+        hi = idx->nseed;
+
+        while (lo < hi)
+        {
+            mid = lo + (hi - lo)/2;
+            if (idx->code[mid] < mCode[iMot]) lo = mid + 1;
+            else hi = mid;
+        }
+
+        off = (mwSize)mPos[iMot] - 1;
+
+        for (i = lo; i < idx->nseed && idx->code[i] == mCode[iMot]; i++)
+        {
+            p = (mwSize)MmPos(idx, i) - 1;
+            if (p < off || p - off >= iLast) continue;
+
+            if (nCand == maxCand)
+            {
+                maxCand *= 2;
+                *cand = (mwSize*)mxRealloc(*cand, maxCand*sizeof(mwSize));
+            }
+
+            (*cand)[nCand++] = p - off;
+        }
+    }
+
+    mxFree(mCode);
+    mxFree(mPos);
+
+    qsort(*cand, nCand, sizeof(mwSize), MmCompareSize);
+
+    for (i = 0, j = 0; i < nCand; i++)
+    {
+        if (j == 0 || (*cand)[i] != (*cand)[j-1]) (*cand)[j++] = (*cand)[i];
+    }
+
+    return j;
+}
+
+
+#endif
@@ -2,11 +2,26 @@
  *  motifcount.c
  *
  *  ind = motifcount(seq,motif_size)
+ *  [ind,stats] = motifcount(seq,motif_size)
+ *  nrec = motifcount(seq,motif_size,region,partfile)
+ *  ... = motifcount({twobitfile,name[,region]},motif_size,...)
  *
  *  returns cell array containing motif and # of repeats found in seq for each subsequence 
  *  of length (motif_size) including reverse compliment 
  *  overlaps not included
  *  
+ *  sharded mode: counts only the windows starting in region = [first last]
+ *  (1-based) and writes a partial count table to partfile instead, 
+ *  see shardio.h. shardmerge combines the parts of all regions into 
+ *  the same cell array as a single call.
+ *  
+ *  the optional stats output holds the work done and the time spent
+ *  in each phase (see callstats.h). every window is an occurrence of
+ *  its motif, hits counts the ones left after overlap removal.
+ *  
+ *  seq can be read from a UCSC .2bit file instead: the sequence name,
+ *  or its bases region = [first last], of twobitfile (see twobit.h).
+ *  
  *  
  *  Brian Kolterman 9/2012
  *=================================================================*/
@@ -17,51 +32,77 @@
 #include <string.h>
 #include "mex.h"
 #include "matrix.h"
+#include "shardio.h"
+#include "twobit.h"
+#include "phaseprof.h"
+#include "callstats.h"
 
 #define SEQ      prhs[0]
 #define MS       prhs[1]
+#define REG      prhs[2]
+#define PART     prhs[3]
 #define OUT      plhs[0]
+#define STATS    plhs[1]
 #define MAX      13
+#define MAXVAR   (2*MAX)
 
 const char bases[4] = "ATCG";
 
 void GetMotif(const int iMot, const mwSize smotif, char *substr);
 void GetIndex(const char *substr, int *iMot);
 void RevComp(char *substr);
+int  GetCanonical(const char *str, const mwSize iSub, const mwSize smotif, char *substr);
 
 void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 {
-	char    *str, *substr;
-	int     iPos, iCh, iSub, iMot1, iMot2, *iNext, *moCount, lSeq;
+	char    *str, *substr, *fname;
+	int     iPos, iCh, iMot1, nVar, iVar, nRec;
+	mwSize  lSeq, iSub, iFirst, iEnd, iHalo, *iNext;
+	long long *moCount;
+	int     varMot[MAXVAR], varDone[MAXVAR];
+	mwSize  varStart[MAXVAR], varFirst[MAXVAR], varNext[MAXVAR];
+	long long varCount[MAXVAR];
 	mwSize *dims, ndim, smotif, nmotif, cmotif, nsubseq;
+	double  *region;
+	FILE    *fid;
+	ShardVariant var[MAXVAR];
+	CallStats st;
+	PROF_DECLARE
 
 	ndim = 2;
+	fname = NULL;
 
 	/* Check for correct number of arguments */     
 
-	if (nrhs != 2) 
+	if (nrhs != 2 && nrhs != 4) 
 	{
-		mexErrMsgTxt("Usage: ind = subseqcount(seq,motif_size)\n");
+		mexErrMsgTxt("Usage: [ind,stats] = motifcount(seq,motif_size) or nrec = motifcount(seq,motif_size,region,partfile)\n");
 	} 
-	if (nlhs > 1)
+	if (nlhs > 2 || (nlhs > 1 && nrhs == 4))
 	{
-		mexErrMsgTxt("Usage: ind = subseqcount(seq,motif_size)\n");
+		mexErrMsgTxt("Usage: [ind,stats] = motifcount(seq,motif_size) or nrec = motifcount(seq,motif_size,region,partfile)\n");
 	}
 
+	StatsInit(&st);
+	StatsPhase(&st, PP_ENCODE);
+	PROF_START();
+	PROF_PHASE(PP_ENCODE);
+
 	/* Check to be sure inputs are correct */
 
-	if (!(mxIsChar(SEQ)))
+	if (!(mxIsChar(SEQ)) && !(mxIsCell(SEQ)))
 	{
-		mexErrMsgTxt("seq must be of type string.\n.");
+		mexErrMsgTxt("seq must be a string or {twobitfile,name[,region]}.\n.");
 	}
 
-	str=mxArrayToString(SEQ);
+	str = mxIsCell(SEQ) ? TwoBitCellToString(SEQ) : mxArrayToString(SEQ);
     
-	lSeq = (int)strlen(str);
+	lSeq = strlen(str);
+	st.bytes = lSeq;
 
-    for (iPos = 0; iPos < lSeq; iPos++)
+    for (iSub = 0; iSub < lSeq; iSub++)
     {
-        if (str[iPos] != 'A' && str[iPos] != 'G' && str[iPos] != 'C' && str[iPos] != 'T')
+        if (str[iSub] != 'A' && str[iSub] != 'G' && str[iSub] != 'C' && str[iSub] != 'T')
         {
             mexErrMsgTxt("invalid sequence.\n.");
         }
@@ -79,16 +120,45 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 		mexErrMsgTxt("motif_size must <= 13.\n.");
 	}
 
+	if (lSeq < smotif)
+	{
+		mexErrMsgTxt("Length of seq must be longer than or equal to motif_size.\n");
+	}
+
 	nsubseq = lSeq - smotif + 1;
     
-    nmotif = (mwSize)pow(4.0,(double)smotif);
+    /* region of windows to count, the whole sequence unless sharded */
+    
+    iFirst = 0;
+    iEnd = nsubseq;
+    
+    if (nrhs == 4)
+    {
+        if (!mxIsDouble(REG) || mxGetNumberOfElements(REG) != 2 || !mxIsChar(PART))
+        {
+            mexErrMsgTxt("region must be [first last] and partfile a string.\n.");
+        }
+        
+        region = mxGetPr(REG);
+        if (region[0] < 1 || region[1] < region[0] || region[1] > (double)nsubseq)
+        {
+            mexErrMsgTxt("region must lie within 1 and length(seq)-motif_size+1.\n.");
+        }
+        
+        iFirst = (mwSize)region[0] - 1;
+        iEnd = (mwSize)region[1];
+        
+        fname = mxArrayToString(PART);
+    }
+    
+    nmotif = (mwSize)1 << (2*smotif);
      
 	/* Set up temproary storage for motifs, indicies and counts */
 
 	substr = (char*)mxCalloc(smotif,sizeof(char*));
     
-    moCount =  (int*)mxCalloc(nmotif,sizeof(int*));
-	iNext = (int*)mxCalloc(nmotif,sizeof(int*));
+    moCount =  (long long*)mxCalloc(nmotif,sizeof(long long));
+	iNext = (mwSize*)mxCalloc(nmotif,sizeof(mwSize));
    
     /*initialize moCount to remove reverse comp in results*/
     
@@ -103,26 +173,72 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
         }
     }
 
+    /* in sharded mode the counted occurrences of a motif depend on the
+       occurrence counted last before the region, which may block the 
+       first smotif-1 windows (the halo). the main count below assumes
+       nothing is blocked, every later occurrence in the halo gets an
+       extra variant chain starting there, and every halo motif one 
+       starting right after the halo */
+    
+    StatsPhase(&st, PP_SCAN);
+    PROF_PHASE(PP_SCAN);
+    
+    nVar = 0;
+    
+    if (fname != NULL)
+    {
+        iHalo = iFirst + smotif - 1;
+        
+        for (iSub = iFirst; iSub < iHalo && iSub < iEnd; iSub++)
+        {
+            iMot1 = GetCanonical(str,iSub,smotif,substr);
+            
+            for (iVar = 0; iVar < nVar; iVar++)
+            {
+                if (varMot[iVar] == iMot1) break;
+            }
+            
+            /* the first occurrence starts the main chain, remember it
+               with the chain starting after the halo */
+            
+            varMot[nVar] = iMot1;
+            varFirst[nVar] = iSub;
+            varStart[nVar] = (iVar == nVar) ? iHalo : iSub;
+            nVar++;
+        }
+        
+        for (iVar = 0; iVar < nVar; iVar++)
+        {
+            varCount[iVar] = 0;
+            varNext[iVar] = varStart[iVar];
+            varDone[iVar] = 0;
+        }
+    }
+
 	/* iterate through subsequences */
 
-	for (iSub = 0; iSub < nsubseq; iSub++)
+	for (iSub = iFirst; iSub < iEnd; iSub++)
 	{
 
-		for (iCh = 0; iCh < smotif; iCh++)
-		{
-			substr[iCh] = str[iSub+iCh];
-		}
-
 		/* Get motif index and increment count (include reverse compliment) */
          
+            iMot1 = GetCanonical(str,iSub,smotif,substr);
             
-            GetIndex(substr,&iMot1);
-            RevComp(substr);
-            GetIndex(substr,&iMot2);
-                        
-            if (iMot2 < iMot1)
+            /* advance the halo variants, a variant that lines up with 
+               the main chain stays in step with it from then on */
+            
+            for (iVar = 0; iVar < nVar; iVar++)
             {
-                iMot1 = iMot2;
+                if (varMot[iVar] != iMot1 || varDone[iVar] || iSub < varNext[iVar]) continue;
+                
+                varCount[iVar]++;
+                varNext[iVar] = iSub + smotif;
+                
+                if (iSub >= iNext[iMot1])
+                {
+                    varCount[iVar] -= moCount[iMot1] + 1;
+                    varDone[iVar] = 1;
+                }
             }
             
             /* ignore overlaps */
@@ -131,7 +247,86 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
             
             moCount[iMot1]++;
             iNext[iMot1] = iSub + smotif; 
+            st.hits++;
+        
+    }
+    
+    
+    st.windows = iEnd - iFirst;
+    st.hitsRaw = st.windows;
+    
+    StatsPhase(&st, PP_OUTPUT);
+    PROF_PHASE(PP_OUTPUT);
+    
+    /* sharded mode: write the partial count table and return */
+    
+    if (fname != NULL)
+    {
+        fid = ShardOpen(fname, SHARD_COUNTS, (long long)smotif, iFirst + 1, iEnd, (long long)nsubseq);
+        
+        if (fid == NULL)
+        {
+            mexErrMsgTxt("could not open partfile for writing.\n.");
+        }
+        
+        nRec = 0;
+        
+        for (iPos = 0; iPos < nmotif; iPos++)
+        {
+            if (moCount[iPos] <= 0) continue;
+            
+            /* main chain, started at the first occurrence */
+            
+            iCh = 0;
+            var[0].start = iFirst + (long long)smotif - 1;
+            var[0].count = moCount[iPos];
+            var[0].next = iNext[iPos];
+            
+            for (iVar = 0; iVar < nVar; iVar++)
+            {
+                if (varMot[iVar] != iPos) continue;
+                
+                iCh++;
+                var[iCh].start = varStart[iVar];
+                
+                if (varStart[iVar] != varFirst[iVar])
+                {
+                    var[0].start = varFirst[iVar];
+                }
+                
+                if (varDone[iVar])
+                {
+                    var[iCh].count = moCount[iPos] + varCount[iVar];
+                    var[iCh].next = iNext[iPos];
+                }
+                else
+                {
+                    var[iCh].count = varCount[iVar];
+                    var[iCh].next = varCount[iVar] > 0 ? varNext[iVar] : 0;
+                }
+            }
+            
+            iCh++;
+            fwrite(&iPos, sizeof(int), 1, fid);
+            fwrite(&iCh, sizeof(int), 1, fid);
+            fwrite(var, sizeof(ShardVariant), iCh, fid);
+            nRec++;
+        }
+        
+        if (!ShardClose(fid, nRec))
+        {
+            mexErrMsgTxt("error writing partfile.\n.");
+        }
         
+        OUT = mxCreateDoubleScalar((double)nRec);
+        
+        mxFree(fname);
+        mxFree(str);
+        mxFree(substr);
+        
+        PROF_REPORT("motifcount", lSeq);
+        
+        return;
     }
     
     
@@ -158,10 +353,15 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
         {
             GetMotif(iPos,smotif,substr);
             mxSetCell(OUT,iCh,mxCreateString(substr));
-            mxSetCell(OUT,iCh+cmotif,mxCreateDoubleScalar(moCount[iPos]));
+            mxSetCell(OUT,iCh+cmotif,mxCreateDoubleScalar((double)moCount[iPos]));
             iCh++;
         }
     }
+    
+    if (nlhs > 1)
+    {
+        STATS = StatsToArray(&st);
+    }
      
     
     
@@ -169,30 +369,45 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
     mxFree(str);
     mxFree(substr);
     
+    PROF_REPORT("motifcount", lSeq);
+    
     return;
 }
 
+/* canonical motif index of the window at iSub, substr is scratch */
+
+int GetCanonical(const char *str, const mwSize iSub, const mwSize smotif, char *substr)
+{
+    int iCh, iMot1, iMot2;
+    
+    for (iCh = 0; iCh < smotif; iCh++)
+    {
+        substr[iCh] = str[iSub+iCh];
+    }
+    
+    GetIndex(substr,&iMot1);
+    RevComp(substr);
+    GetIndex(substr,&iMot2);
+    
+    return (iMot2 < iMot1) ? iMot2 : iMot1;
+}
+
 void GetMotif(const int iMot, const mwSize smotif, char *substr)
 {
-    int i, p, rem;
- 
-    rem = iMot;
+    int i;
     
     for (i = 0; i < smotif; i++)
     {
-        p = (int)floor((double)rem/pow(4.0,(double)(smotif-i-1)));
-        rem = rem % (int)pow(4.0,(double)(smotif-i-1));
-        substr[i] = bases[p];
+        substr[i] = bases[(iMot >> (2*(smotif-i-1))) & 3];
     }
     
 }
 
 void GetIndex(const char *substr, int *iMot)
 {
-    int i, num, smotif;
+    int i, num;
     i = 0;
     *iMot = 0;
-    smotif = strlen(substr);
     
     while (substr[i] != 0)
     {
@@ -215,9 +430,13 @@ void GetIndex(const char *substr, int *iMot)
         case 'G':
         num = 3;
         break;
+        
+        default:
+        num = 0;
+        break;
         }    
         
-        *iMot += num*(int)pow(4.0,(double)(smotif-i-1));
+        *iMot = (*iMot << 2) | num;
         
         i++;
     }
@@ -237,7 +456,7 @@ void RevComp(char *substr)
     
     i = 0;
     
-    while (smotif >= 0)
+    while (smotif > 0)
     {
         smotif--;
         
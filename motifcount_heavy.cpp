@@ -0,0 +1,609 @@
+/*=================================================================
+ *  motifcount_heavy.cpp
+ *
+ *  ind = motifcount_heavy(seq,motif_size,min_count,mem_mb)
+ *  ind = motifcount_heavy(seq,motif_size,min_count,mem_mb,nthreads)
+ *  [ind,sketch] = motifcount_heavy(...)
+ *  sketch = motifcount_heavy(seq,motif_size,[],mem_mb,nthreads)
+ *  ind = motifcount_heavy(seq,motif_size,min_count,sketch,nthreads)
+ *
+ *  returns the rows of motifcount(seq,motif_size) with a count of at
+ *  least min_count (the same cell array of motifs and counts, reverse
+ *  compliments together, overlaps not counted) without a table of
+ *  every word, for inputs too large for one. motif_size may be up to
+ *  31, words containing anything but A, C, G, T are skipped.
+ *
+ *  a first pass counts every word in a count-min sketch of about
+ *  mem_mb megabytes, a second pass counts exactly the words the sketch
+ *  puts at min_count or more. the sketch never underestimates, so the
+ *  result is exact; only the memory of the second pass depends on how
+ *  many words the sketch lets through.
+ *
+ *  the sketch is blocked: each word hashes to one 64 byte block of 16
+ *  uint32 counters, 4 rows of 4, and uses one counter per row, so an
+ *  update touches a single cache line. updates are conservative (only
+ *  the smallest of the 4 counters are raised). seq is split into one
+ *  range per thread (overlapping by motif_size-1). in the first pass
+ *  the table is cut into one slice per thread (the largest power of
+ *  two up to nthreads), each thread sketches its range in its slice,
+ *  and the slices are added and repeated over the table, so mem_mb is
+ *  the whole memory of the sketch; the estimates are those of a sketch
+ *  as many times smaller as there are slices, which only lets more
+ *  candidates through to the second pass. the second pass counts each
+ *  range apart and joins the counts at the range ends.
+ *
+ *  sketch is a struct with fields k and table (uint32, 16 counters per
+ *  block, a power of two of blocks). sketches of the same k and size
+ *  from other parts of the input merge by adding their tables, e.g.
+ *  s1.table = s1.table + s2.table, and one passed in place of mem_mb
+ *  is used for the second pass instead of a first pass over seq. with
+ *  a sketch passed in, every word of seq the sketch puts at min_count
+ *  or more is returned with its count in seq, however small, so the
+ *  results of the parts can be added and min_count applied to the sum
+ *  (a word overlapping itself across the end of a part may then be
+ *  counted once more than motifcount would).
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include "mex.h"
+
+
+#define SEQ      prhs[0]
+#define MS       prhs[1]
+#define MINC     prhs[2]
+#define MEM      prhs[3]
+#define NTH      prhs[4]
+#define OUT      plhs[0]
+#define SKETCH   plhs[1]
+#define MAX      31
+#define BLOCK    16     /* counters per block, one cache line */
+#define ROWS     4      /* counters updated per word, one per row */
+#define PREFETCH 16     /* words between prefetching a block and using it */
+
+#if defined(__GNUC__)
+#define PrefetchBlock(p)  __builtin_prefetch(p)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define PrefetchBlock(p)  _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define PrefetchBlock(p)
+#endif
+
+const char bases[4] = {'A', 'T', 'C', 'G'};
+
+
+// exact count of a candidate word in one range, the start of its first
+// counted occurrence and the end of its last
+
+struct HeavyCount
+{
+    long long count;
+    int64_t   first, next;
+};
+
+struct HeavyJob
+{
+    const char *str;
+    int     smotif, nthreads;
+    uint32_t *table;
+    uint64_t nBlk, sliceBlk;
+    int     nSlice;
+    long long minCount;
+    std::vector<int64_t> lo;
+    std::vector<std::unordered_map<uint64_t, HeavyCount> > found;
+};
+
+
+// 64 bit finalizer, spreads the canonical code over block and slots
+
+static inline uint64_t Mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+
+    return x;
+}
+
+
+// counter of a word in row r of its block
+
+#define SLOT(h, r)  ((r)*(BLOCK/ROWS) + (int)(((h) >> (2*(r))) & (BLOCK/ROWS - 1)))
+
+
+// splits str into n ranges of word starts, lo[t] to lo[t+1]-1
+
+void SplitRanges(HeavyJob *job, int64_t len, int n)
+{
+    int i;
+
+    job->lo.resize(n+1);
+
+    for (i = 0; i <= n; i++) job->lo[i] = len*i/n;
+}
+
+
+// calls fn(code, pos, block, h) for the canonical code of every word
+// of str not containing N that starts in range t, in order, with its
+// block of a table of nBlk blocks. the block of a word is prefetched
+// PREFETCH words before fn gets it, so the misses of consecutive words
+// overlap
+
+template <class Fn>
+void ForEachWord(const HeavyJob *job, int t, uint32_t *table, uint64_t nBlk, Fn fn)
+{
+    uint64_t fwd, rev, mask, num, code, h, blk;
+    uint64_t ringCode[PREFETCH], ringH[PREFETCH];
+    int64_t  ringPos[PREFETCH];
+    int64_t  iPos, end, run;
+    int      smotif = job->smotif, nRing, iRing, j;
+
+    mask = ((uint64_t)1 << (2*smotif)) - 1;
+    fwd = rev = 0;
+    run = 0;
+    nRing = iRing = 0;
+
+    // the range reads motif_size-1 characters into the next one
+
+    end = job->lo[t+1] + smotif - 1;
+    if (end > job->lo.back()) end = job->lo.back();
+
+    for (iPos = job->lo[t]; iPos < end; iPos++)
+    {
+        switch (job->str[iPos])
+        {
+            case 'A': num = 0; break;
+            case 'T': num = 1; break;
+            case 'C': num = 2; break;
+            case 'G': num = 3; break;
+            default:  run = 0; continue;
+        }
+
+        fwd = ((fwd << 2) | num) & mask;
+        rev = (rev >> 2) | ((num^1) << (2*(smotif-1)));
+        run++;
+
+        if (run < smotif) continue;
+
+        code = rev < fwd ? rev : fwd;
+        h = Mix(code);
+        blk = (h >> 8) & (nBlk - 1);
+
+        PrefetchBlock(table + blk*BLOCK);
+
+        if (nRing == PREFETCH)
+        {
+            fn(ringCode[iRing], ringPos[iRing], table + ((ringH[iRing] >> 8) & (nBlk - 1))*BLOCK, ringH[iRing]);
+        }
+        else
+        {
+            nRing++;
+        }
+
+        ringCode[iRing] = code;
+        ringPos[iRing] = iPos - smotif + 1;
+        ringH[iRing] = h;
+        iRing = (iRing + 1) % PREFETCH;
+    }
+
+    // the words still in the ring, oldest first
+
+    iRing = (iRing + PREFETCH - nRing) % PREFETCH;
+
+    for (j = 0; j < nRing; j++, iRing = (iRing + 1) % PREFETCH)
+    {
+        fn(ringCode[iRing], ringPos[iRing], table + ((ringH[iRing] >> 8) & (nBlk - 1))*BLOCK, ringH[iRing]);
+    }
+}
+
+
+// smallest of the counters of a word
+
+static inline uint32_t Estimate(const uint32_t *b, uint64_t h)
+{
+    uint32_t m;
+    int r;
+
+    m = b[SLOT(h, 0)];
+    for (r = 1; r < ROWS; r++) if (b[SLOT(h, r)] < m) m = b[SLOT(h, r)];
+
+    return m;
+}
+
+
+// first pass: conservative update of slice t of the table from range t
+
+void SketchWorker(HeavyJob *job, int t)
+{
+    ForEachWord(job, t, job->table + t*job->sliceBlk*BLOCK, job->sliceBlk, [](uint64_t, int64_t, uint32_t *b, uint64_t h)
+    {
+        uint32_t m;
+        int r;
+
+        m = Estimate(b, h);
+
+        if (m == UINT32_MAX) return;
+
+        for (r = 0; r < ROWS; r++) if (b[SLOT(h, r)] == m) b[SLOT(h, r)] = m + 1;
+    });
+}
+
+
+// adds the other slices to part t of slice 0, saturating
+
+void AddWorker(HeavyJob *job, int t)
+{
+    uint64_t i, n = job->sliceBlk*BLOCK, iLo = n*t/job->nSlice, iHi = n*(t+1)/job->nSlice;
+    uint32_t sum;
+    int      j;
+
+    for (j = 1; j < job->nSlice; j++)
+    {
+        const uint32_t *add = job->table + j*n;
+
+        for (i = iLo; i < iHi; i++)
+        {
+            sum = job->table[i] + add[i];
+            job->table[i] = sum < add[i] ? UINT32_MAX : sum;
+        }
+    }
+}
+
+
+// copies slice 0 over slice t. a word in block b of the whole table is
+// in block b of slice 0 modulo the slice, with the same slots, so the
+// repeated slice is a sketch of the whole size that never underestimates
+
+void TileWorker(HeavyJob *job, int t)
+{
+    memcpy(job->table + t*job->sliceBlk*BLOCK, job->table, job->sliceBlk*BLOCK*sizeof(uint32_t));
+}
+
+
+// second pass: exact counts in the range of thread t, with the
+// non-overlap rule, of the words the sketch puts at minCount or more
+
+void ExactWorker(HeavyJob *job, int t)
+{
+    std::unordered_map<uint64_t, HeavyCount> &found = job->found[t];
+
+    ForEachWord(job, t, job->table, job->nBlk, [job, &found](uint64_t code, int64_t pos, uint32_t *b, uint64_t h)
+    {
+        HeavyCount *c;
+
+        if ((long long)Estimate(b, h) < job->minCount) return;
+
+        c = &found[code];
+
+        if (c->count > 0 && pos < c->next) return;
+
+        if (c->count == 0) c->first = pos;
+
+        c->count++;
+        c->next = pos + job->smotif;
+    });
+}
+
+
+// joins the count c of code in the range of thread t to the count m of
+// the ranges before it. when the last occurrence counted in m overlaps
+// the first counted in c, the range is read again counting from the end
+// of m, alongside the count of c, until both count the same occurrence;
+// from there on they agree
+
+void JoinCount(const HeavyJob *job, int t, uint64_t code, HeavyCount *m, const HeavyCount *c)
+{
+    uint64_t fwd, rev, mask, num;
+    int64_t  iPos, pos, end, run, next, nextC;
+    long long count, countC;
+    int      smotif = job->smotif;
+
+    if (m->next <= c->first)
+    {
+        m->count += c->count;
+        m->next = c->next;
+        return;
+    }
+
+    mask = ((uint64_t)1 << (2*smotif)) - 1;
+    fwd = rev = 0;
+    run = 0;
+    count = countC = 0;
+    next = m->next;
+    nextC = c->first;
+
+    end = job->lo[t+1] + smotif - 1;
+    if (end > job->lo.back()) end = job->lo.back();
+
+    for (iPos = c->first; iPos < end; iPos++)
+    {
+        switch (job->str[iPos])
+        {
+            case 'A': num = 0; break;
+            case 'T': num = 1; break;
+            case 'C': num = 2; break;
+            case 'G': num = 3; break;
+            default:  run = 0; continue;
+        }
+
+        fwd = ((fwd << 2) | num) & mask;
+        rev = (rev >> 2) | ((num^1) << (2*(smotif-1)));
+        run++;
+
+        if (run < smotif || (rev < fwd ? rev : fwd) != code) continue;
+
+        pos = iPos - smotif + 1;
+
+        if (pos >= next && pos >= nextC)
+        {
+            m->count += count + c->count - countC;
+            m->next = c->next;
+            return;
+        }
+        if (pos >= next)
+        {
+            count++;
+            next = pos + smotif;
+        }
+        if (pos >= nextC)
+        {
+            countC++;
+            nextC = pos + smotif;
+        }
+    }
+
+    m->count += count;
+    m->next = next;
+}
+
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    const char *fields[2] = {"k", "table"};
+    mxArray *mxTable;
+    char    *substr;
+    int     nthreads, i, iCh;
+    bool    build;
+    double  mem;
+    int64_t len;
+    long long minOut;
+    mwSize  nWord, iWord;
+    HeavyJob job;
+    std::vector<std::thread> workers;
+    std::vector<std::pair<uint64_t, long long> > words;
+    std::unordered_map<uint64_t, HeavyCount>::iterator it, itAll;
+
+
+    // Check for correct number of arguments
+
+    if (nrhs < 4 || nrhs > 5)
+    {
+        mexErrMsgTxt("Usage: [ind,sketch] = motifcount_heavy(seq,motif_size,min_count,mem_mb or sketch,nthreads)\n");
+    }
+    if (nlhs > 2)
+    {
+        mexErrMsgTxt("Usage: [ind,sketch] = motifcount_heavy(seq,motif_size,min_count,mem_mb or sketch,nthreads)\n");
+    }
+
+    // Check to be sure inputs are correct
+
+    if (!(mxIsChar(SEQ)))
+    {
+        mexErrMsgTxt("seq must be of type string.\n.");
+    }
+
+    if (mxGetNumberOfElements(MS) != 1)
+    {
+        mexErrMsgTxt("motif_size must be a scalar.\n.");
+    }
+
+    job.smotif = (int)mxGetScalar(MS);
+
+    if (job.smotif < 1 || job.smotif > MAX)
+    {
+        mexErrMsgTxt("motif_size must be 1..31.\n.");
+    }
+
+    // an empty min_count only builds the sketch
+
+    if (mxIsEmpty(MINC))
+    {
+        job.minCount = -1;
+    }
+    else if (mxGetNumberOfElements(MINC) != 1 || mxGetScalar(MINC) < 1)
+    {
+        mexErrMsgTxt("min_count must be a positive scalar.\n.");
+    }
+    else
+    {
+        job.minCount = (long long)mxGetScalar(MINC);
+    }
+
+    nthreads = (int)std::thread::hardware_concurrency();
+
+    if (nrhs == 5)
+    {
+        if (mxGetNumberOfElements(NTH) != 1)
+        {
+            mexErrMsgTxt("nthreads must be a scalar.\n.");
+        }
+        nthreads = (int)mxGetScalar(NTH);
+    }
+
+    if (nthreads < 1) nthreads = 1;
+
+
+    // The sketch: a new one of mem_mb, or the one passed in
+
+    build = !mxIsStruct(MEM);
+
+    if (build)
+    {
+        if (mxGetNumberOfElements(MEM) != 1 || mxGetScalar(MEM) <= 0)
+        {
+            mexErrMsgTxt("mem_mb must be a positive scalar.\n.");
+        }
+
+        mem = mxGetScalar(MEM)*1048576.0;
+
+        for (job.nBlk = 1; 2.0*(double)job.nBlk*BLOCK*sizeof(uint32_t) <= mem; job.nBlk *= 2);
+
+        mxTable = mxCreateNumericMatrix((mwSize)(job.nBlk*BLOCK), 1, mxUINT32_CLASS, mxREAL);
+    }
+    else
+    {
+        if (mxGetField(MEM, 0, "k") == NULL || mxGetField(MEM, 0, "table") == NULL)
+        {
+            mexErrMsgTxt("sketch must be a struct made by motifcount_heavy.\n.");
+        }
+        if ((int)mxGetScalar(mxGetField(MEM, 0, "k")) != job.smotif)
+        {
+            mexErrMsgTxt("sketch was made for another motif_size.\n.");
+        }
+
+        mxTable = mxGetField(MEM, 0, "table");
+        job.nBlk = mxGetNumberOfElements(mxTable)/BLOCK;
+
+        if (mxGetClassID(mxTable) != mxUINT32_CLASS || job.nBlk == 0
+            || job.nBlk*BLOCK != mxGetNumberOfElements(mxTable) || (job.nBlk & (job.nBlk - 1)) != 0)
+        {
+            mexErrMsgTxt("sketch table must be uint32 with a power of two blocks of 16.\n.");
+        }
+        if (job.minCount < 0)
+        {
+            mexErrMsgTxt("min_count is needed with a sketch.\n.");
+        }
+    }
+
+    job.str = mxArrayToString(SEQ);
+    job.table = (uint32_t*)mxGetData(mxTable);
+    job.nthreads = nthreads;
+    job.found.resize(nthreads);
+
+    len = (int64_t)strlen(job.str);
+
+
+    // First pass: the sketch, one slice of the table per thread
+
+    if (build)
+    {
+        for (job.nSlice = 1; 2*job.nSlice <= nthreads && (uint64_t)(2*job.nSlice) <= job.nBlk; job.nSlice *= 2);
+
+        job.sliceBlk = job.nBlk/job.nSlice;
+        SplitRanges(&job, len, job.nSlice);
+
+        for (i = 0; i < job.nSlice; i++) workers.push_back(std::thread(SketchWorker, &job, i));
+        for (i = 0; i < job.nSlice; i++) workers[i].join();
+
+        workers.clear();
+
+        if (job.nSlice > 1)
+        {
+            for (i = 0; i < job.nSlice; i++) workers.push_back(std::thread(AddWorker, &job, i));
+            for (i = 0; i < job.nSlice; i++) workers[i].join();
+
+            workers.clear();
+
+            for (i = 1; i < job.nSlice; i++) workers.push_back(std::thread(TileWorker, &job, i));
+            for (i = 1; i < job.nSlice; i++) workers[i-1].join();
+
+            workers.clear();
+        }
+    }
+
+    // the word starts of thread t are lo[t] to lo[t+1]-1
+
+    SplitRanges(&job, len, nthreads);
+
+
+    // Second pass: exact counts of the heavy candidates
+
+    if (job.minCount >= 0)
+    {
+        for (i = 0; i < nthreads; i++) workers.push_back(std::thread(ExactWorker, &job, i));
+        for (i = 0; i < nthreads; i++) workers[i].join();
+
+        // join the ranges in order into the counts of thread 0
+
+        for (i = 1; i < nthreads; i++)
+        {
+            for (it = job.found[i].begin(); it != job.found[i].end(); ++it)
+            {
+                itAll = job.found[0].find(it->first);
+
+                if (itAll == job.found[0].end()) job.found[0].insert(*it);
+                else JoinCount(&job, i, it->first, &itAll->second, &it->second);
+            }
+            std::unordered_map<uint64_t, HeavyCount>().swap(job.found[i]);
+        }
+
+        // with a sketch passed in seq is a part, every admitted word is
+        // returned so the parts can be added
+
+        minOut = build ? job.minCount : 1;
+
+        for (it = job.found[0].begin(); it != job.found[0].end(); ++it)
+        {
+            if (it->second.count >= minOut)
+            {
+                words.push_back(std::make_pair(it->first, it->second.count));
+            }
+        }
+        std::unordered_map<uint64_t, HeavyCount>().swap(job.found[0]);
+
+        // rows in motifcount order, by code
+
+        std::sort(words.begin(), words.end());
+
+        nWord = words.size();
+        OUT = mxCreateCellMatrix(nWord, 2);
+        substr = (char*)mxCalloc(job.smotif+1, sizeof(char));
+
+        for (iWord = 0; iWord < nWord; iWord++)
+        {
+            for (iCh = 0; iCh < job.smotif; iCh++)
+            {
+                substr[iCh] = bases[(words[iWord].first >> (2*(job.smotif-1-iCh))) & 3];
+            }
+
+            mxSetCell(OUT, iWord, mxCreateString(substr));
+            mxSetCell(OUT, iWord + nWord, mxCreateDoubleScalar((double)words[iWord].second));
+        }
+
+        mxFree(substr);
+    }
+
+
+    // Sketch output, the first output when only building it
+
+    if (build && (nlhs > 1 || job.minCount < 0))
+    {
+        mxArray *sk = mxCreateStructMatrix(1, 1, 2, fields);
+
+        mxSetField(sk, 0, "k", mxCreateDoubleScalar(job.smotif));
+        mxSetField(sk, 0, "table", mxTable);
+
+        if (job.minCount < 0) OUT = sk;
+        else SKETCH = sk;
+    }
+    else
+    {
+        if (build) mxDestroyArray(mxTable);
+        if (nlhs > 1) SKETCH = mxDuplicateArray(MEM);
+    }
+
+    mxFree((void*)job.str);
+
+    return;
+}
@@ -0,0 +1,235 @@
+/*=================================================================
+ *  motifcount_mismatch.c
+ *
+ *  ind = motifcount_mismatch(seq,motif_size,d)
+ *
+ *  returns cell array containing motif and # of windows in seq that
+ *  match it with up to d mismatches, for each word of length
+ *  (motif_size), reverse compliments counted together as in
+ *  motifcount (for a word that is not its own reverse compliment
+ *  windows matching either strand are added up)
+ *
+ *  the words of seq are counted exactly once into a dense table,
+ *  which is then summed over Hamming balls of radius d with one pass
+ *  per position and distance (O(motif_size*d*4^motif_size)) instead
+ *  of scanning seq once per word.
+ *
+ *  all windows are counted, overlapping or not, and windows containing
+ *  anything but A, C, G, T are skipped
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "mex.h"
+#include "matrix.h"
+
+#define SEQ      prhs[0]
+#define MS       prhs[1]
+#define DIST     prhs[2]
+#define OUT      plhs[0]
+#define MAX      13
+
+const char bases[4] = "ATCG";
+
+void GetMotif(const int iMot, const mwSize smotif, char *substr);
+int  RevCompCode(const int iMot, const int smotif);
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *str, *substr;
+    int     smotif, d, iCh, iDist, iMot1, iMot2, num, stride;
+    mwSize  lSeq, iPos, run;
+    unsigned int **layer, *lo, *hi, sum;
+    mwSize  nmotif, cmotif, iBlk, iOff, i0, dims[2];
+    double  count;
+
+    /* Check for correct number of arguments */
+
+    if (nrhs != 3)
+    {
+        mexErrMsgTxt("Usage: ind = motifcount_mismatch(seq,motif_size,d)\n");
+    }
+    if (nlhs > 1)
+    {
+        mexErrMsgTxt("Usage: ind = motifcount_mismatch(seq,motif_size,d)\n");
+    }
+
+    /* Check to be sure inputs are correct */
+
+    if (!(mxIsChar(SEQ)))
+    {
+        mexErrMsgTxt("seq must be of type string.\n.");
+    }
+
+    if (mxGetNumberOfElements(MS) != 1 || mxGetNumberOfElements(DIST) != 1)
+    {
+        mexErrMsgTxt("motif_size and d must be scalars.\n.");
+    }
+
+    smotif = (int)mxGetScalar(MS);
+    d = (int)mxGetScalar(DIST);
+
+    if (smotif < 1 || smotif > MAX)
+    {
+        mexErrMsgTxt("motif_size must be 1..13.\n.");
+    }
+
+    if (d < 0)
+    {
+        mexErrMsgTxt("d must be >= 0.\n.");
+    }
+
+    if (d > smotif) d = smotif;
+
+    nmotif = (mwSize)1 << (2*smotif);
+
+    /* layer[j] holds, per word, the windows differing from it in
+       exactly j of the positions handled so far */
+
+    layer = (unsigned int**)mxCalloc(d+1,sizeof(unsigned int*));
+
+    for (iDist = 0; iDist <= d; iDist++)
+    {
+        layer[iDist] = (unsigned int*)mxCalloc(nmotif,sizeof(unsigned int));
+    }
+
+    /* exact forward strand counts, rolling 2 bit code (A T C G) */
+
+    str = mxArrayToString(SEQ);
+    lSeq = strlen(str);
+
+    iMot1 = 0;
+    run = 0;
+
+    for (iPos = 0; iPos < lSeq; iPos++)
+    {
+        switch (str[iPos])
+        {
+            case 'A': num = 0; break;
+            case 'T': num = 1; break;
+            case 'C': num = 2; break;
+            case 'G': num = 3; break;
+            default:  num = -1; break;
+        }
+
+        if (num < 0)
+        {
+            run = 0;
+            continue;
+        }
+
+        iMot1 = (int)(((mwSize)iMot1 << 2 | num) & (nmotif - 1));
+        run++;
+
+        if (run >= (mwSize)smotif) layer[0][iMot1]++;
+    }
+
+    mxFree(str);
+
+    /* Hamming ball transform, one position at a time. layers are updated
+       from the highest distance down so layer[j-1] is still the one
+       before this position when layer[j] is updated */
+
+    for (iCh = 0; iCh < smotif; iCh++)
+    {
+        stride = 1 << (2*iCh);
+
+        for (iDist = d; iDist >= 1; iDist--)
+        {
+            lo = layer[iDist-1];
+            hi = layer[iDist];
+
+            for (iBlk = 0; iBlk < nmotif; iBlk += 4*(mwSize)stride)
+            {
+                for (iOff = 0; iOff < stride; iOff++)
+                {
+                    i0 = iBlk + iOff;
+                    sum = lo[i0] + lo[i0+stride] + lo[i0+2*stride] + lo[i0+3*stride];
+
+                    hi[i0]          += sum - lo[i0];
+                    hi[i0+stride]   += sum - lo[i0+stride];
+                    hi[i0+2*stride] += sum - lo[i0+2*stride];
+                    hi[i0+3*stride] += sum - lo[i0+3*stride];
+                }
+            }
+        }
+    }
+
+    for (iDist = 1; iDist <= d; iDist++)
+    {
+        for (i0 = 0; i0 < nmotif; i0++)
+        {
+            layer[0][i0] += layer[iDist][i0];
+        }
+        mxFree(layer[iDist]);
+    }
+
+    /* create matlab cell array with motif counts, same rows as motifcount */
+
+    cmotif = 0;
+
+    for (i0 = 0; i0 < nmotif; i0++)
+    {
+        if (RevCompCode((int)i0,smotif) >= (int)i0) cmotif++;
+    }
+
+    dims[0] = cmotif;
+    dims[1] = 2;
+
+    OUT = mxCreateCellArray(2, dims);
+
+    substr = (char*)mxCalloc(smotif+1,sizeof(char));
+
+    iCh = 0;
+    for (i0 = 0; i0 < nmotif; i0++)
+    {
+        iMot2 = RevCompCode((int)i0,smotif);
+
+        if (iMot2 < (int)i0) continue;
+
+        count = (double)layer[0][i0];
+        if (iMot2 != (int)i0) count += (double)layer[0][iMot2];
+
+        GetMotif((int)i0,smotif,substr);
+        mxSetCell(OUT,iCh,mxCreateString(substr));
+        mxSetCell(OUT,iCh+cmotif,mxCreateDoubleScalar(count));
+        iCh++;
+    }
+
+    mxFree(layer[0]);
+    mxFree(layer);
+    mxFree(substr);
+
+    return;
+}
+
+void GetMotif(const int iMot, const mwSize smotif, char *substr)
+{
+    int i;
+
+    for (i = 0; i < smotif; i++)
+    {
+        substr[i] = bases[(iMot >> (2*(smotif-i-1))) & 3];
+    }
+    substr[smotif] = 0;
+}
+
+/* code of the reverse compliment, complement of a base code is code^1 */
+
+int RevCompCode(const int iMot, const int smotif)
+{
+    int i, rev;
+
+    rev = 0;
+
+    for (i = 0; i < smotif; i++)
+    {
+        rev = (rev << 2) | (((iMot >> (2*i)) & 3) ^ 1);
+    }
+
+    return rev;
+}
@@ -0,0 +1,393 @@
+/*=================================================================
+ *  motifcount_window.c
+ *
+ *  [counts,motifs] = motifcount_window(seq,motif_size,win,step)
+ *  counts = motifcount_window(seq,motif_size,win,step,motifs)
+ *  ... = motifcount_window({twobitfile,name},motif_size,win,step,...)
+ *  ... = motifcount_window({twobitfile,name,region},motif_size,win,step,...)
+ *
+ *  k-mer spectrum track along seq: counts(:,j) holds the number of
+ *  occurrences of every word of length (motif_size) in the window of
+ *  win bases starting at base (j-1)*step+1, reverse compliments
+ *  counted together. rows are in the order motifcount returns them
+ *  and motifs is the matching cell array of words. passing a cell
+ *  array of words as motifs returns only their tracks, in that order.
+ *
+ *  unlike motifcount, overlapping occurrences are all counted (the
+ *  non-overlap rule depends on where a window starts and cannot be
+ *  updated incrementally) and words containing anything but A, C, G,
+ *  T are skipped, so chromosome sequences with N runs can be used.
+ *
+ *  counts are updated incrementally as the window slides: step words
+ *  enter and step words leave per window, so the cost is O(length(seq))
+ *  plus the size of the output. counts is a uint32 matrix.
+ *
+ *  seq can also be read from a UCSC .2bit file: sequence name, or its
+ *  bases region = [first last] (1-based, inclusive), of twobitfile.
+ *  the packed bases are used as they are, without decoding the
+ *  sequence to text (see twobit.h); soft-masked bases count as bases
+ *  and N runs are skipped. windows are then numbered from first.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "mex.h"
+#include "matrix.h"
+#include "twobit.h"
+
+#define SEQ      prhs[0]
+#define MS       prhs[1]
+#define WIN      prhs[2]
+#define STEP     prhs[3]
+#define SEL      prhs[4]
+#define OUT      plhs[0]
+#define MOT      plhs[1]
+#define MAX      13
+
+const char bases[4] = "ATCG";
+
+/* motifcount code (A T C G = 0..3, 4 = not a base) of the 2bit codes
+   T C A G and TB_N */
+
+const int twoBitToCode[5] = {1, 2, 0, 3, 4};
+
+/* rolling canonical code of the word starting at pos, words are coded
+   with motifcount's base order (A T C G) so that the complement of a
+   base code is code^1. bases come from str or, if str is NULL, from
+   a 2bit sequence starting at base first */
+
+typedef struct
+{
+    const char *str;
+    TwoBitCursor cur;
+    unsigned int first;
+    mwSize  lSeq, pos, end, run;
+    int     smotif;
+    unsigned int fwd, rev, mask;
+} Roller;
+
+void RollInit(Roller *r, const char *str, const TwoBitSeq *tbs, const unsigned int first,
+              const mwSize lSeq, const int smotif);
+int  RollNext(Roller *r);
+void GetMotif(const int iMot, const mwSize smotif, char *substr);
+int  GetCanonicalCode(const char *substr, const int smotif);
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *str, *substr;
+    int     smotif, iPos, iRow, nRow, code, *rows, *moCount;
+    mwSize  lSeq, win, step, nWin, iWin;
+    unsigned int *counts, *col;
+    mwSize  nmotif;
+    Roller  in, out;
+    TwoBitFile tb;
+    TwoBitSeq tbs;
+    const char *err;
+    char    *fname;
+    double  first, last;
+
+    /* Check for correct number of arguments */
+
+    if (nrhs != 4 && nrhs != 5)
+    {
+        mexErrMsgTxt("Usage: [counts,motifs] = motifcount_window(seq,motif_size,win,step[,motifs])\n");
+    }
+    if (nlhs > 2)
+    {
+        mexErrMsgTxt("Usage: [counts,motifs] = motifcount_window(seq,motif_size,win,step[,motifs])\n");
+    }
+
+    /* Check to be sure inputs are correct */
+
+    if (!(mxIsChar(SEQ)) && !(mxIsCell(SEQ) && (mxGetNumberOfElements(SEQ) == 2 || mxGetNumberOfElements(SEQ) == 3)))
+    {
+        mexErrMsgTxt("seq must be of type string or {twobitfile,name[,region]}.\n.");
+    }
+
+    if (mxGetNumberOfElements(MS) != 1 || mxGetNumberOfElements(WIN) != 1 || mxGetNumberOfElements(STEP) != 1)
+    {
+        mexErrMsgTxt("motif_size, win and step must be scalars.\n.");
+    }
+
+    smotif = (int)mxGetScalar(MS);
+
+    if (smotif < 1 || smotif > MAX)
+    {
+        mexErrMsgTxt("motif_size must be 1..13.\n.");
+    }
+
+    if (mxGetScalar(WIN) < smotif || mxGetScalar(STEP) < 1)
+    {
+        mexErrMsgTxt("win must be >= motif_size and step >= 1.\n.");
+    }
+
+    win = (mwSize)mxGetScalar(WIN);
+    step = (mwSize)mxGetScalar(STEP);
+
+    nmotif = (mwSize)1 << (2*smotif);
+
+    substr = (char*)mxCalloc(smotif+1,sizeof(char));
+
+    /* rows of the output: all canonical words or the selected ones */
+
+    if (nrhs == 5)
+    {
+        if (!mxIsCell(SEL))
+        {
+            mexErrMsgTxt("motifs must be a cell array of words.\n.");
+        }
+
+        nRow = (int)mxGetNumberOfElements(SEL);
+        rows = (int*)mxCalloc(nRow > 0 ? nRow : 1,sizeof(int));
+
+        for (iRow = 0; iRow < nRow; iRow++)
+        {
+            if (mxGetCell(SEL,iRow) == NULL || !mxIsChar(mxGetCell(SEL,iRow))
+                || mxGetNumberOfElements(mxGetCell(SEL,iRow)) != smotif)
+            {
+                mexErrMsgTxt("motifs must be words of length motif_size.\n.");
+            }
+
+            mxGetString(mxGetCell(SEL,iRow),substr,smotif+1);
+            rows[iRow] = GetCanonicalCode(substr,smotif);
+
+            if (rows[iRow] < 0)
+            {
+                mexErrMsgTxt("motifs may only contain A, C, G and T.\n.");
+            }
+        }
+    }
+    else
+    {
+        nRow = 0;
+        rows = (int*)mxCalloc(nmotif/2 + (1 << smotif),sizeof(int));
+
+        for (iPos = 0; iPos < nmotif; iPos++)
+        {
+            GetMotif(iPos,smotif,substr);
+            if (GetCanonicalCode(substr,smotif) == iPos)
+            {
+                rows[nRow] = iPos;
+                nRow++;
+            }
+        }
+    }
+
+    if (nlhs > 1)
+    {
+        MOT = mxCreateCellMatrix(nRow,1);
+
+        for (iRow = 0; iRow < nRow; iRow++)
+        {
+            GetMotif(rows[iRow],smotif,substr);
+            mxSetCell(MOT,iRow,mxCreateString(substr));
+        }
+    }
+
+    /* the sequence, as text or in a mapped 2bit file */
+
+    str = NULL;
+    tb.map = NULL;
+    first = 1;
+
+    if (mxIsCell(SEQ))
+    {
+        if (mxGetCell(SEQ,0) == NULL || !mxIsChar(mxGetCell(SEQ,0)) || mxGetCell(SEQ,1) == NULL || !mxIsChar(mxGetCell(SEQ,1)))
+        {
+            mexErrMsgTxt("twobitfile and name must be of type string.\n.");
+        }
+
+        fname = mxArrayToString(mxGetCell(SEQ,0));
+        err = TwoBitOpen(fname, &tb);
+        mxFree(fname);
+
+        if (err != NULL)
+        {
+            mexErrMsgTxt(err);
+        }
+
+        fname = mxArrayToString(mxGetCell(SEQ,1));
+        iRow = TwoBitFind(&tb, fname);
+        mxFree(fname);
+
+        err = (iRow < 0) ? "no sequence of that name in the 2bit file.\n." : TwoBitSeqGet(&tb, iRow, &tbs);
+
+        if (err != NULL)
+        {
+            TwoBitClose(&tb);
+            mexErrMsgTxt(err);
+        }
+
+        last = tbs.len;
+
+        if (mxGetNumberOfElements(SEQ) == 3)
+        {
+            if (mxGetCell(SEQ,2) == NULL || !mxIsDouble(mxGetCell(SEQ,2)) || mxGetNumberOfElements(mxGetCell(SEQ,2)) != 2)
+            {
+                TwoBitClose(&tb);
+                mexErrMsgTxt("region must be [first last].\n.");
+            }
+
+            first = mxGetPr(mxGetCell(SEQ,2))[0];
+            last = mxGetPr(mxGetCell(SEQ,2))[1];
+
+            if (first < 1 || last < first - 1 || last > tbs.len)
+            {
+                TwoBitClose(&tb);
+                mexErrMsgTxt("region must lie within 1 and the sequence length.\n.");
+            }
+        }
+
+        lSeq = (mwSize)(last - first + 1);
+    }
+    else
+    {
+        str = mxArrayToString(SEQ);
+        lSeq = strlen(str);
+    }
+
+    nWin = (lSeq >= win) ? (lSeq - win)/step + 1 : 0;
+
+    OUT = mxCreateNumericMatrix(nRow, nWin, mxUINT32_CLASS, mxREAL);
+    counts = (unsigned int*)mxGetData(OUT);
+
+    moCount = (int*)mxCalloc(nmotif,sizeof(int));
+
+    /* words enter at the window end and leave at the window start */
+
+    RollInit(&in,str,&tbs,(unsigned int)first-1,lSeq,smotif);
+    RollInit(&out,str,&tbs,(unsigned int)first-1,lSeq,smotif);
+
+    for (iWin = 0; iWin < nWin; iWin++)
+    {
+        while (in.pos <= iWin*step + win - smotif)
+        {
+            code = RollNext(&in);
+            if (code >= 0) moCount[code]++;
+        }
+
+        while (out.pos < iWin*step)
+        {
+            code = RollNext(&out);
+            if (code >= 0) moCount[code]--;
+        }
+
+        col = counts + iWin*nRow;
+
+        for (iRow = 0; iRow < nRow; iRow++)
+        {
+            col[iRow] = (unsigned int)moCount[rows[iRow]];
+        }
+    }
+
+    if (str != NULL) mxFree(str);
+    if (tb.map != NULL) TwoBitClose(&tb);
+    mxFree(substr);
+    mxFree(rows);
+    mxFree(moCount);
+
+    return;
+}
+
+void RollInit(Roller *r, const char *str, const TwoBitSeq *tbs, const unsigned int first,
+              const mwSize lSeq, const int smotif)
+{
+    r->str = str;
+    r->first = first;
+    if (str == NULL) TwoBitCursorInit(&r->cur, tbs, first);
+    r->lSeq = lSeq;
+    r->smotif = smotif;
+    r->pos = 0;
+    r->end = 0;
+    r->run = 0;
+    r->fwd = 0;
+    r->rev = 0;
+    r->mask = (1u << (2*smotif)) - 1;
+}
+
+/* canonical code of the word at r->pos (-1 if it contains anything but
+   A, C, G, T) and advance to the next word */
+
+int RollNext(Roller *r)
+{
+    unsigned int num;
+
+    while (r->end < r->pos + r->smotif)
+    {
+        if (r->str == NULL)
+        {
+            num = twoBitToCode[TwoBitCode(&r->cur, r->first + r->end)];
+        }
+        else switch (r->str[r->end])
+        {
+            case 'A': num = 0; break;
+            case 'T': num = 1; break;
+            case 'C': num = 2; break;
+            case 'G': num = 3; break;
+            default:  num = 4; break;
+        }
+
+        if (num == 4)
+        {
+            r->run = 0;
+            num = 0;
+        }
+        else
+        {
+            r->run++;
+        }
+
+        r->fwd = ((r->fwd << 2) | num) & r->mask;
+        r->rev = (r->rev >> 2) | ((num^1) << (2*(r->smotif-1)));
+        r->end++;
+    }
+
+    r->pos++;
+
+    if (r->run < (mwSize)r->smotif) return -1;
+
+    return (int)((r->rev < r->fwd) ? r->rev : r->fwd);
+}
+
+void GetMotif(const int iMot, const mwSize smotif, char *substr)
+{
+    int i;
+
+    for (i = 0; i < smotif; i++)
+    {
+        substr[i] = bases[(iMot >> (2*(smotif-i-1))) & 3];
+    }
+    substr[smotif] = 0;
+}
+
+/* code of the smaller of a word and its reverse compliment, -1 if it
+   contains anything but A, C, G, T */
+
+int GetCanonicalCode(const char *substr, const int smotif)
+{
+    int i, num, fwd, rev;
+
+    fwd = 0;
+    rev = 0;
+
+    for (i = 0; i < smotif; i++)
+    {
+        switch (substr[i])
+        {
+            case 'A': num = 0; break;
+            case 'T': num = 1; break;
+            case 'C': num = 2; break;
+            case 'G': num = 3; break;
+            default:  return -1;
+        }
+
+        fwd = (fwd << 2) | num;
+        rev = rev | ((num^1) << (2*i));
+    }
+
+    return (rev < fwd) ? rev : fwd;
+}
@@ -2,11 +2,44 @@
  *  motifind.cpp
  *
  *  ind = motifind(seq1,seq2,pct_ident)
+ *  ind = motifind(seq1,seq2,pct_ident,index)
+ *  [ind,stats] = motifind(...)
+ *  nhits = motifind(seq1,seq2,pct_ident,region,partfile)
+ *  ind = motifind(...,mask)
+ *  ind = motifind({twobitfile,name[,region]},seq2,pct_ident,...)
  *
  *  returns indicies in seq1 where seq2 has >= pct_ident 
  *  percentage of characters in common excluding overlapping words
+ *  (an int64 row, exact for sequences of any length)
  * 
+ *  a logical mask, one per character of seq2, makes a gapped motif:
+ *  only the columns where mask is true are compared and pct_ident is
+ *  the percentage of those in common, the others are don't-care
+ *  (e.g. the spacer of a bipartite site). a window still spans all of
+ *  seq2 for overlaps. the cost follows the informative columns.
+ *
+ *  motifs of FFT_MIN_MOTIF or more bases are scored with the FFT 
+ *  match counting engine (fftmatch.h)
  *  
+ *  sharded mode: scans only the windows starting in region = [first last]
+ *  (1-based) and writes every window passing pct_ident to partfile 
+ *  (see shardio.h). shardmerge removes overlaps across all parts.
+ *
+ *  with a minimizer index of seq1 (mmindex) only windows seeded by the
+ *  index are scored, whenever pct_ident is high enough for the seeding
+ *  to find every hit (see mmindex.h). the result is the same. gapped
+ *  motifs are scanned exhaustively.
+ *
+ *  the optional stats output holds the work done and the time spent
+ *  in each phase (see callstats.h). the scan is the same as without
+ *  it; for hits_raw the windows overlapping a hit, which the scan
+ *  skips, are scored apart, outside windows, abandoned and the phase
+ *  times.
+ *
+ *  seq1 can be read from a UCSC .2bit file: sequence name, or its
+ *  bases region = [first last], of twobitfile, decoded from the mapped
+ *  file (see twobit.h). indicies then count from the first base read.
+ *
  *  Brian Kolterman 8/2012
  *=================================================================*/
 
@@ -14,42 +47,90 @@
 #include <stdio.h>
 #include <string.h> /* strlen */
 #include "mex.h"
+#include "shardio.h"
+#include "twobit.h"
+#include "fftmatch.h"
+#include "mmindex.h"
+#include "hitbuf.h"
+#include "phaseprof.h"
+#include "callstats.h"
 
 
 #define PID     prhs[2]
 #define OUT     plhs[0]
+#define REG     prhs[3]
+#define PART    prhs[4]
+#define INDEX   prhs[3]
+#define STATS   plhs[1]
+
+
+mwSize MaskOffsets(const mxArray *mask, mwSize lSt2, mwSize *off, bool *inf);
+mwSize OverlapHits(const char *str1, const char *str2, const mwSize *off, mwSize nInf, mwSize iFrom, mwSize iTo, double pct_ident);
 
 void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 {
     char    *str1, *str2;
-    int     lSt1, lSt2, iPos, iCh, iLast, nHits;
-    double  score, pct_ident, *ind;
-    int     *indTemp;
+    mwSize  lSt1, lSt2, iPos, iCh, iLast, iFirst, iEnd, iBlk, nBlk, iNext;
+    mwSize  nInf, *off;
+    const mxArray *mask;
+    bool    *inf;
+    double  score, pct_ident;
+    long long nHits, nMis, maxMis;
+    int     *counts;
+    HitBuf  hits;
+    bool    useFft, rawHits;
+    MatchEngine eng;
+    char    *fname;
+    FILE    *fid;
+    long long hit;
+    MmIndex mmi;
+    const char *err;
+    mwSize  *cand, nCand, iCand;
+    CallStats st;
+    PROF_DECLARE
+    
     
+    // Check for correct number of arguments, a trailing logical is 
+    // the mask of a gapped motif
     
-    // Check for correct number of arguments     
+    mask = NULL;
     
-    if (nrhs != 3) 
+    if (nrhs > 3 && mxIsLogical(prhs[nrhs-1]))
     {
-        mexErrMsgTxt("Usage: ind = motifind(seq1,seq2,pct_ident)\n");
+        mask = prhs[--nrhs];
+    }
+    
+    if (nrhs < 3 || nrhs > 5) 
+    {
+        mexErrMsgTxt("Usage: [ind,stats] = motifind(seq1,seq2,pct_ident[,index][,mask]) or nhits = motifind(seq1,seq2,pct_ident,region,partfile[,mask])\n");
     } 
-    if (nlhs > 1)
+    if (nlhs > 2 || (nlhs > 1 && nrhs == 5))
     {
-        mexErrMsgTxt("Usage: ind = motifind(seq1,seq2,pct_ident)\n");
+        mexErrMsgTxt("Usage: [ind,stats] = motifind(seq1,seq2,pct_ident[,index][,mask]) or nhits = motifind(seq1,seq2,pct_ident,region,partfile[,mask])\n");
     }
     
+    memset(&mmi, 0, sizeof(mmi));
+    StatsInit(&st);
+    StatsPhase(&st, PP_ENCODE);
+    PROF_START();
+    PROF_PHASE(PP_ENCODE);
+    
     // Check to be sure inputs are correct
     
-    if (!(mxIsChar(prhs[0])) && !(mxIsChar(prhs[1])))
+    if (!(mxIsChar(prhs[0])) && !(mxIsCell(prhs[0])))
+    {
+        mexErrMsgTxt("seq1 must be a string or {twobitfile,name[,region]}.\n.");
+    }
+    if (!(mxIsChar(prhs[1])))
     {
-        mexErrMsgTxt("seq1 and seq2 must be of type string.\n.");
+        mexErrMsgTxt("seq2 must be of type string.\n.");
     }
     
-    str1=mxArrayToString(prhs[0]);
+    str1 = mxIsCell(prhs[0]) ? TwoBitCellToString(prhs[0]) : mxArrayToString(prhs[0]);
     str2=mxArrayToString(prhs[1]);
     
-    lSt1 = (int)strlen(str1);
-    lSt2 = (int)strlen(str2);
+    lSt1 = strlen(str1);
+    lSt2 = strlen(str2);
     
     if (lSt1 < lSt2)
     {
@@ -65,52 +146,336 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
     
     pct_ident = mxGetScalar(PID);
     
+    st.bytes = lSt1 + lSt2;
+    
     
-    // Set up temproary storage for hit indicies
+    // Offsets of the informative columns, all of them without a mask
     
-    indTemp = (int*)mxCalloc(lSt1,sizeof(int));
+    off = (mwSize*)mxCalloc(lSt2 > 0 ? lSt2 : 1,sizeof(mwSize));
+    inf = (bool*)mxCalloc(lSt2 > 0 ? lSt2 : 1,sizeof(bool));
+    
+    nInf = MaskOffsets(mask, lSt2, off, inf);
+    
+    
+    // Most mismatches a passing window can have, scoring of a window 
+    // is abandoned once it has more
+    
+    maxMis = (long long)nInf;
+    
+    while (maxMis >= 0 && (double)((long long)nInf - maxMis)/(double)nInf < pct_ident)
+    {
+        maxMis--;
+    }
+    
+    rawHits = (nlhs > 1);
+    iNext = 0;
+    
+    
+    // Region of windows to scan, the whole sequence unless sharded
     
     iLast = (lSt1 - lSt2 + 1);
     
+    iFirst = 0;
+    iEnd = iLast;
+    fid = NULL;
+    
+    if (nrhs == 5)
+    {
+        if (!mxIsDouble(REG) || mxGetNumberOfElements(REG) != 2 || !mxIsChar(PART))
+        {
+            mexErrMsgTxt("region must be [first last] and partfile a string.\n.");
+        }
+        
+        if (mxGetPr(REG)[0] < 1 || mxGetPr(REG)[1] < mxGetPr(REG)[0] || mxGetPr(REG)[1] > (double)iLast)
+        {
+            mexErrMsgTxt("region must lie within 1 and length(seq1)-motif_length+1.\n.");
+        }
+        
+        iFirst = (mwSize)mxGetPr(REG)[0] - 1;
+        iEnd = (mwSize)mxGetPr(REG)[1];
+        
+        fname = mxArrayToString(PART);
+        fid = ShardOpen(fname, SHARD_HITS, lSt2, iFirst + 1, iEnd, iLast);
+        mxFree(fname);
+        
+        if (fid == NULL)
+        {
+            mexErrMsgTxt("could not open partfile for writing.\n.");
+        }
+    }
+    
+    
+    // Hit indicies, stored in chunks as they are found
+    
+    HitInit(&hits, 0);
+    
     nHits = 0;
     
+    StatsPhase(&st, PP_SCAN);
+    PROF_PHASE(PP_SCAN);
+    
+    
+    // Seeded search: score only the candidates from the index
+    
+    if (nrhs == 4)
+    {
+        err = MmIndexFromArray(INDEX, &mmi);
+        
+        if (err != NULL)
+        {
+            mexErrMsgTxt(err);
+        }
+        if (mmi.n != lSt1)
+        {
+            mexErrMsgTxt("index must be built from seq1.\n.");
+        }
+        
+        if (nInf == lSt2 && MmUsable(&mmi, str2, lSt2, pct_ident))
+        {
+            nCand = MmCandidates(&mmi, str2, lSt2, iLast, &cand);
+            
+            for (iCand = 0; iCand < nCand; iCand++)
+            {
+                if (cand[iCand] < iNext) continue;
+                
+                score = 0.0;
+                nMis = 0;
+                st.windows++;
+                
+                for (iCh = 0; iCh < lSt2; iCh++)
+                {
+                    if (str1[iCh+cand[iCand]] == str2[iCh])
+                    {
+                        score = score + 1.0;
+                    }
+                    else if (++nMis > maxMis)
+                    {
+                        break;
+                    }
+                }
+                
+                if (nMis > maxMis)
+                {
+                    if (iCh+1 < lSt2) st.abandoned++;
+                    continue;
+                }
+                
+                if (score/(double)lSt2 >= pct_ident)
+                {
+                    st.hitsRaw++;
+                    
+                    HitAdd(&hits, (long long)cand[iCand]+1, 0.0, 0.0);
+                    nHits++;
+                    iNext = cand[iCand] + lSt2;
+                    
+                    // the skipped overlapping windows, for hits_raw only
+                    
+                    if (rawHits)
+                    {
+                        StatsPhase(&st, PP_NONE);
+                        PROF_PHASE(PP_NONE);
+                        st.hitsRaw += OverlapHits(str1, str2, off, nInf, cand[iCand]+1, iNext < iLast ? iNext : iLast, pct_ident);
+                        StatsPhase(&st, PP_SCAN);
+                        PROF_PHASE(PP_SCAN);
+                    }
+                }
+            }
+            
+            mxFree(cand);
+            
+            iEnd = iFirst;  // nothing left to scan
+        }
+    }
+    
+    
+    // Long motifs: match counts of a block of windows at a time by FFT
+    
+    useFft = UseFftMatch(nInf, iEnd - iFirst) && MatchEngineInit(&eng, str2, lSt2, inf);
+    
+    counts = NULL;
+    iBlk = nBlk = 0;
+    
+    if (useFft)
+    {
+        counts = (int*)mxCalloc(eng.step,sizeof(int));
+    }
+    
     
     // Do the comparison
     
-    for (iPos = 0; iPos < iLast; iPos++)
+    for (iPos = iFirst; iPos < iEnd; iPos++)
     {
-        score = 0.0;
+        st.windows++;
         
-        for (iCh = 0; iCh < lSt2; iCh++)
+        if (useFft)
         {
-            if (str1[iCh+iPos] == str2[iCh])
+            if (iPos >= iBlk + nBlk)
             {
-                score = score + 1.0;
+                iBlk = iPos;
+                nBlk = MatchCounts(&eng, str1, lSt1, iBlk, iEnd, counts);
+            }
+            
+            score = (double)counts[iPos-iBlk];
+        }
+        else
+        {
+            score = 0.0;
+            nMis = 0;
+            
+            for (iCh = 0; iCh < nInf; iCh++)
+            {
+                if (str1[off[iCh]+iPos] == str2[off[iCh]])
+                {
+                    score = score + 1.0;
+                }
+                else if (++nMis > maxMis)
+                {
+                    break;
+                }
+            }
+            
+            if (nMis > maxMis)
+            {
+                if (iCh+1 < nInf) st.abandoned++;
+                continue;
             }
         }
         
-        score = score/(double)lSt2;
+        score = score/(double)nInf;
         
         if (score >= pct_ident)
         {
-            indTemp[nHits] = iPos+1;
+            st.hitsRaw++;
+            
+            // sharded: keep every passing window, overlaps are removed 
+            // by shardmerge
+            
+            if (fid != NULL)
+            {
+                hit = iPos+1;
+                fwrite(&hit, sizeof(hit), 1, fid);
+                nHits++;
+                continue;
+            }
+            
+            HitAdd(&hits, (long long)iPos+1, 0.0, 0.0);
             nHits++;
+            
+            // the skipped overlapping windows, for hits_raw only
+            
+            if (rawHits)
+            {
+                StatsPhase(&st, PP_NONE);
+                PROF_PHASE(PP_NONE);
+                st.hitsRaw += OverlapHits(str1, str2, off, nInf, iPos+1, iPos+lSt2 < iEnd ? iPos+lSt2 : iEnd, pct_ident);
+                StatsPhase(&st, PP_SCAN);
+                PROF_PHASE(PP_SCAN);
+            }
+            
             iPos += (lSt2-1);
         }
     }
+    
+    StatsPhase(&st, PP_OUTPUT);
+    PROF_PHASE(PP_OUTPUT);
+    
+    if (fid != NULL)
+    {
+        if (!ShardClose(fid, nHits))
+        {
+            mexErrMsgTxt("error writing partfile.\n.");
+        }
+        
+        OUT = mxCreateDoubleScalar((double)nHits);
+        
+        mxFree(str1);
+        mxFree(str2);
+        mxFree(counts);
+        mxFree(off);
+        mxFree(inf);
+        HitFree(&hits);
+        PROF_REPORT("motifind", lSt1);
+        return;
+    }
      
-    // Remove extra zeros 
+    // Copy the hit chunks to the output
     
-    OUT = mxCreateDoubleMatrix(1, nHits, mxREAL);
-    ind = mxGetPr(OUT);
+    OUT = HitPositions(&hits);
+    HitFree(&hits);
     
-    for (iPos = 0; iPos < nHits; iPos++)
+    if (nlhs > 1)
     {
-        ind[iPos] = indTemp[iPos];
+        st.hits = nHits;
+        STATS = StatsToArray(&st);
     }
     
     mxFree(str1);
     mxFree(str2);
+    mxFree(counts);
+    mxFree(off);
+    mxFree(inf);
+    
+    PROF_REPORT("motifind", lSt1);
     
     return;
 }
+
+
+
+// MaskOffsets lists the columns of a motif of lSt2 characters that
+// mask (NULL = all) marks informative in off and flags them in inf, 
+// returns their number
+
+mwSize MaskOffsets(const mxArray *mask, mwSize lSt2, mwSize *off, bool *inf)
+{
+    mwSize  iCh, nInf;
+    mxLogical *m;
+    
+    if (mask != NULL && mxGetNumberOfElements(mask) != lSt2)
+    {
+        mexErrMsgTxt("mask must have one element per motif character.\n.");
+    }
+    
+    m = (mask != NULL) ? mxGetLogicals(mask) : NULL;
+    nInf = 0;
+    
+    for (iCh = 0; iCh < lSt2; iCh++)
+    {
+        inf[iCh] = (m == NULL || m[iCh]);
+        
+        if (inf[iCh]) off[nInf++] = iCh;
+    }
+    
+    if (nInf == 0 && lSt2 > 0)
+    {
+        mexErrMsgTxt("mask must keep at least one motif character.\n.");
+    }
+    
+    return nInf;
+}
+
+
+// number of windows iFrom..iTo-1 passing pct_ident, the windows after
+// a hit that the scan skips, scored only for the hits_raw stat
+
+mwSize OverlapHits(const char *str1, const char *str2, const mwSize *off, mwSize nInf, mwSize iFrom, mwSize iTo, double pct_ident)
+{
+    mwSize iPos, iCh, n;
+    double score;
+    
+    n = 0;
+    
+    for (iPos = iFrom; iPos < iTo; iPos++)
+    {
+        score = 0.0;
+        
+        for (iCh = 0; iCh < nInf; iCh++)
+        {
+            if (str1[off[iCh]+iPos] == str2[off[iCh]]) score = score + 1.0;
+        }
+        
+        if (score/(double)nInf >= pct_ident) n++;
+    }
+    
+    return n;
+}
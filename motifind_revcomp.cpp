@@ -2,13 +2,39 @@
  *  motifind_revcomp.cpp
  *
  *  ind = motifind_revcomp(seq1,seq2,pct_ident)
+ *  [ind,strand,score,stats] = motifind_revcomp(seq1,seq2,pct_ident)
+ *  nhits = motifind_revcomp(seq1,seq2,pct_ident,region,partfile)
+ *  ind = motifind_revcomp(...,mask)
+ *  ind = motifind_revcomp({twobitfile,name[,region]},seq2,pct_ident,...)
  *
  *  returns indicies in seq1 where seq2 has >= pct_ident 
  *  percentage of characters in common counting reverse-compliment 
- *  and excluding overlaps 
+ *  and excluding overlaps (an int64 row)
  *   
- * 
+ *  a logical mask, one per character of seq2, makes a gapped motif:
+ *  only the columns where mask is true (and the matching columns of
+ *  the reverse compliment) are compared and pct_ident is the
+ *  percentage of those in common. a window still spans all of seq2.
  *  
+ *  optional outputs give the strand of each hit (1 = seq2 as given, 
+ *  -1 = reverse compliment, the better scoring one if both pass) and 
+ *  its percentage of characters in common on that strand
+ *
+ *  the optional stats output holds the work done and the time spent
+ *  in each phase (see callstats.h). the scan is the same as without
+ *  it; for hits_raw the windows overlapping a hit, which the scan
+ *  skips, are scored apart, outside windows, abandoned and the phase
+ *  times.
+ *
+ *  sharded mode: scans only the windows starting in region = [first last]
+ *  (1-based) and writes every window passing pct_ident to partfile 
+ *  (see shardio.h) with its strand and score. shardmerge removes
+ *  overlaps across all parts.
+ *
+ *  seq1 can be read from a UCSC .2bit file: sequence name, or its
+ *  bases region = [first last], of twobitfile (see twobit.h), with
+ *  indicies counted from the first base read.
+ *
  *  Brian Kolterman 8/2012
  *=================================================================*/
 
@@ -16,54 +42,93 @@
 #include <stdio.h>
 #include <string.h> /* strlen */
 #include "mex.h"
+#include "shardio.h"
+#include "twobit.h"
+#include "hitbuf.h"
+#include "phaseprof.h"
+#include "callstats.h"
 
 
 #define PID     prhs[2]
 #define OUT     plhs[0]
-#define MAX      13
+#define STRAND  plhs[1]
+#define SCORE   plhs[2]
+#define STATS   plhs[3]
+#define REG     prhs[3]
+#define PART    prhs[4]
 
 
 void RevComp(char *substr, char *substrR);
+mwSize MaskOffsets(const mxArray *mask, mwSize lSt2, mwSize *off, mwSize *offR);
+mwSize OverlapHits(const char *str1, const char *str2, const char *str2R, const mwSize *off, const mwSize *offR, mwSize nInf, mwSize iFrom, mwSize iTo, double pct_ident);
+
 
 void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 {
     char    *str1, *str2, *str2R;
-    int     lSt1, lSt2, iPos, iCh, iLast, nHits;
-    double  score, scoreR, pct_ident, *ind;
-    int     *indTemp;
+    mwSize  lSt1, lSt2, iPos, iCh, iLast, nInf, *off, *offR;
+    const mxArray *mask;
+    long long nHits, nMis, nMisR, maxMis;
+    double  score, scoreR, pct_ident;
+    HitBuf  hits;
+    mwSize  iFirst, iEnd;
+    char    *fname;
+    FILE    *fid;
+    ShardHit hit;
+    bool    rawHits;
+    CallStats st;
+    PROF_DECLARE
+    
     
+    // Check for correct number of arguments, a trailing logical is 
+    // the mask of a gapped motif
     
-    // Check for correct number of arguments     
+    mask = NULL;
+    
+    if (nrhs > 3 && mxIsLogical(prhs[nrhs-1]))
+    {
+        mask = prhs[--nrhs];
+    }
     
-    if (nrhs != 3) 
+    if (nrhs != 3 && nrhs != 5) 
     {
-        mexErrMsgTxt("Usage: ind = motifind_revcomp(seq1,seq2,pct_ident)\n");
+        mexErrMsgTxt("Usage: [ind,strand,score,stats] = motifind_revcomp(seq1,seq2,pct_ident[,mask]) or nhits = motifind_revcomp(seq1,seq2,pct_ident,region,partfile[,mask])\n");
     } 
-    if (nlhs > 1)
+    if (nlhs > 4 || (nlhs > 1 && nrhs == 5))
     {
-        mexErrMsgTxt("Usage: ind = motifind_revcomp(seq1,seq2,pct_ident)\n");
+        mexErrMsgTxt("Usage: [ind,strand,score,stats] = motifind_revcomp(seq1,seq2,pct_ident[,mask]) or nhits = motifind_revcomp(seq1,seq2,pct_ident,region,partfile[,mask])\n");
     }
     
+    StatsInit(&st);
+    StatsPhase(&st, PP_ENCODE);
+    PROF_START();
+    PROF_PHASE(PP_ENCODE);
+    
     // Check to be sure inputs are correct
     
-    if (!(mxIsChar(prhs[0])) && !(mxIsChar(prhs[1])))
+    if (!(mxIsChar(prhs[0])) && !(mxIsCell(prhs[0])))
+    {
+        mexErrMsgTxt("seq1 must be a string or {twobitfile,name[,region]}.\n.");
+    }
+    if (!(mxIsChar(prhs[1])))
     {
-        mexErrMsgTxt("seq1 and seq2 must be of type string.\n.");
+        mexErrMsgTxt("seq2 must be of type string.\n.");
     }
     
-    str1=mxArrayToString(prhs[0]);
+    str1 = mxIsCell(prhs[0]) ? TwoBitCellToString(prhs[0]) : mxArrayToString(prhs[0]);
     str2=mxArrayToString(prhs[1]);
     str2R=mxArrayToString(prhs[1]);
     
     RevComp(str2,str2R);
      
-    lSt1 = (int)strlen(str1);
-    lSt2 = (int)strlen(str2);
+    lSt1 = strlen(str1);
+    lSt2 = strlen(str2);
     
     if (lSt1 < lSt2)
     {
         mxFree(str1);
         mxFree(str2);    
+        mxFree(str2R);
         mexErrMsgTxt("Length of str1 must be longer than or equal to length of str2.\n");
     }
     
@@ -74,61 +139,211 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
     
     pct_ident = mxGetScalar(PID);
     
+    st.bytes = lSt1 + 2*lSt2;
+    
+    
+    // Offsets of the informative columns of both strands, all of them
+    // without a mask
+    
+    off = (mwSize*)mxCalloc(lSt2 > 0 ? lSt2 : 1,sizeof(mwSize));
+    offR = (mwSize*)mxCalloc(lSt2 > 0 ? lSt2 : 1,sizeof(mwSize));
     
-    // Set up temproary storage for hit indicies
+    nInf = MaskOffsets(mask, lSt2, off, offR);
     
-    indTemp = (int*)mxCalloc(lSt1,sizeof(int));
+    
+    // Most mismatches a passing window can have, scoring of a window 
+    // is abandoned once both strands have more
+    
+    maxMis = (long long)nInf;
+    
+    while (maxMis >= 0 && (double)((long long)nInf - maxMis)/(double)nInf < pct_ident)
+    {
+        maxMis--;
+    }
+    
+    
+    // Region of windows to scan, the whole sequence unless sharded
     
     iLast = (lSt1 - lSt2 + 1);
     
+    iFirst = 0;
+    iEnd = iLast;
+    fid = NULL;
+    
+    if (nrhs == 5)
+    {
+        if (!mxIsDouble(REG) || mxGetNumberOfElements(REG) != 2 || !mxIsChar(PART))
+        {
+            mexErrMsgTxt("region must be [first last] and partfile a string.\n.");
+        }
+        
+        if (mxGetPr(REG)[0] < 1 || mxGetPr(REG)[1] < mxGetPr(REG)[0] || mxGetPr(REG)[1] > (double)iLast)
+        {
+            mexErrMsgTxt("region must lie within 1 and length(seq1)-motif_length+1.\n.");
+        }
+        
+        iFirst = (mwSize)mxGetPr(REG)[0] - 1;
+        iEnd = (mwSize)mxGetPr(REG)[1];
+        
+        fname = mxArrayToString(PART);
+        fid = ShardOpen(fname, SHARD_SCORED, lSt2, iFirst + 1, iEnd, iLast);
+        mxFree(fname);
+        
+        if (fid == NULL)
+        {
+            mexErrMsgTxt("could not open partfile for writing.\n.");
+        }
+    }
+    
+    
+    // Set up growable storage for hits
+    
+    HitInit(&hits, 1);
+    
     nHits = 0;
     
+    rawHits = (nlhs > 3);
+    
+    StatsPhase(&st, PP_SCAN);
+    PROF_PHASE(PP_SCAN);
+    
     
     // Do the comparison
     
-    for (iPos = 0; iPos < iLast; iPos++)
+    for (iPos = iFirst; iPos < iEnd; iPos++)
     {
         score = 0.0;
         scoreR = 0.0;
+        nMis = 0;
+        nMisR = 0;
+        st.windows++;
         
         
-        for (iCh = 0; iCh < lSt2; iCh++)
+        for (iCh = 0; iCh < nInf; iCh++)
         {
-            if (str1[iCh+iPos] == str2[iCh])
+            if (str1[off[iCh]+iPos] == str2[off[iCh]])
             {
                 score = score + 1.0;
             }
+            else
+            {
+                nMis++;
+            }
             
-            if (str1[iCh+iPos] == str2R[iCh])
+            if (str1[offR[iCh]+iPos] == str2R[offR[iCh]])
             {
                 scoreR = scoreR + 1.0;
             }
+            else
+            {
+                nMisR++;
+            }
+            
+            if (nMis > maxMis && nMisR > maxMis) break;
+        }
+        
+        if (nMis > maxMis && nMisR > maxMis)
+        {
+            if (iCh+1 < nInf) st.abandoned++;
+            continue;
         }
         
         
-        score = score/(double)lSt2;
-        scoreR = scoreR/(double)lSt2;
+        score = score/(double)nInf;
+        scoreR = scoreR/(double)nInf;
         
         if (score >= pct_ident || scoreR >= pct_ident)
         {
-            indTemp[nHits] = iPos+1;
+            st.hitsRaw++;
+            
+            // sharded: keep every passing window, overlaps are removed 
+            // by shardmerge
+            
+            if (fid != NULL)
+            {
+                hit.pos = iPos+1;
+                hit.strand = (score >= scoreR) ? 1.0 : -1.0;
+                hit.score = (score >= scoreR) ? score : scoreR;
+                fwrite(&hit, sizeof(hit), 1, fid);
+                nHits++;
+                continue;
+            }
+            
+            if (score >= scoreR)
+            {
+                HitAdd(&hits, (long long)iPos+1, 1.0, score);
+            }
+            else
+            {
+                HitAdd(&hits, (long long)iPos+1, -1.0, scoreR);
+            }
             nHits++;
+            
+            // the skipped overlapping windows, for hits_raw only
+            
+            if (rawHits)
+            {
+                StatsPhase(&st, PP_NONE);
+                PROF_PHASE(PP_NONE);
+                st.hitsRaw += OverlapHits(str1, str2, str2R, off, offR, nInf, iPos+1, iPos+lSt2 < iEnd ? iPos+lSt2 : iEnd, pct_ident);
+                StatsPhase(&st, PP_SCAN);
+                PROF_PHASE(PP_SCAN);
+            }
+            
             iPos += (lSt2-1);
         }
     }
+    
+    StatsPhase(&st, PP_OUTPUT);
+    PROF_PHASE(PP_OUTPUT);
+    
+    if (fid != NULL)
+    {
+        if (!ShardClose(fid, nHits))
+        {
+            mexErrMsgTxt("error writing partfile.\n.");
+        }
+        
+        OUT = mxCreateDoubleScalar((double)nHits);
+        HitFree(&hits);
+        
+        mxFree(str1);
+        mxFree(str2);
+        mxFree(str2R);
+        mxFree(off);
+        mxFree(offR);
+        PROF_REPORT("motifind_revcomp", lSt1);
+        return;
+    }
      
-    // Remove extra zeros 
+    // Copy hit columns to the outputs
     
-    OUT = mxCreateDoubleMatrix(1, nHits, mxREAL);
-    ind = mxGetPr(OUT);
+    OUT = HitPositions(&hits);
+    
+    if (nlhs > 1)
+    {
+        STRAND = HitStrands(&hits);
+    }
     
-    for (iPos = 0; iPos < nHits; iPos++)
+    if (nlhs > 2)
     {
-        ind[iPos] = indTemp[iPos];
+        SCORE = HitScores(&hits);
     }
     
+    if (nlhs > 3)
+    {
+        st.hits = nHits;
+        STATS = StatsToArray(&st);
+    }
+    
+    HitFree(&hits);
     mxFree(str1);
     mxFree(str2);
+    mxFree(str2R);
+    mxFree(off);
+    mxFree(offR);
+    
+    PROF_REPORT("motifind_revcomp", lSt1);
     
     return;
 }
@@ -137,22 +352,12 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 
 void RevComp(char *substr, char *substrR)
 {
-    char temp[MAX];
     int i, smotif;
     smotif = strlen(substr);
     
     for (i = 0; i < smotif; i++)
     {
-        temp[i] = substr[i];
-    }
-    
-    i = 0;
-    
-    while (smotif >= 0)
-    {
-        smotif--;
-        
-        switch  (temp[smotif])
+        switch  (substr[smotif-i-1])
         {
             case 'A':
             substrR[i] = 'T';
@@ -170,8 +375,71 @@ void RevComp(char *substr, char *substrR)
             substrR[i] = 'C';
             break;
         }
-            
-        i++;
     }
     
 }
+
+
+// MaskOffsets lists the columns of a motif of lSt2 characters that
+// mask (NULL = all) marks informative in off, and in offR those of 
+// its reverse compliment (the mask reversed), returns their number
+
+mwSize MaskOffsets(const mxArray *mask, mwSize lSt2, mwSize *off, mwSize *offR)
+{
+    mwSize  iCh, nInf;
+    mxLogical *m;
+    
+    if (mask != NULL && mxGetNumberOfElements(mask) != lSt2)
+    {
+        mexErrMsgTxt("mask must have one element per motif character.\n.");
+    }
+    
+    m = (mask != NULL) ? mxGetLogicals(mask) : NULL;
+    nInf = 0;
+    
+    for (iCh = 0; iCh < lSt2; iCh++)
+    {
+        if (m == NULL || m[iCh]) off[nInf++] = iCh;
+    }
+    
+    for (iCh = 0; iCh < nInf; iCh++)
+    {
+        offR[iCh] = lSt2 - 1 - off[nInf - 1 - iCh];
+    }
+    
+    if (nInf == 0 && lSt2 > 0)
+    {
+        mexErrMsgTxt("mask must keep at least one motif character.\n.");
+    }
+    
+    return nInf;
+}
+
+
+// number of windows iFrom..iTo-1 passing pct_ident on either strand,
+// the windows after a hit that the scan skips, scored only for the
+// hits_raw stat
+
+mwSize OverlapHits(const char *str1, const char *str2, const char *str2R, const mwSize *off, const mwSize *offR, mwSize nInf, mwSize iFrom, mwSize iTo, double pct_ident)
+{
+    mwSize iPos, iCh, n;
+    double score, scoreR;
+    
+    n = 0;
+    
+    for (iPos = iFrom; iPos < iTo; iPos++)
+    {
+        score = 0.0;
+        scoreR = 0.0;
+        
+        for (iCh = 0; iCh < nInf; iCh++)
+        {
+            if (str1[off[iCh]+iPos] == str2[off[iCh]]) score = score + 1.0;
+            if (str1[offR[iCh]+iPos] == str2R[offR[iCh]]) scoreR = scoreR + 1.0;
+        }
+        
+        if (score/(double)nInf >= pct_ident || scoreR/(double)nInf >= pct_ident) n++;
+    }
+    
+    return n;
+}
@@ -2,57 +2,124 @@
  *  motifind_revcomp_profile.cpp
  *
  *  ind = motifind_revcomp_profile(seq1,motif_profile,pct_ident)
+ *  [ind,strand,score,stats] = motifind_revcomp_profile(seq1,motif_profile,pct_ident)
+ *  nhits = motifind_revcomp_profile(seq1,motif_profile,pct_ident,region,partfile)
+ *  ind = motifind_revcomp_profile(...,mask)
+ *  ind = motifind_revcomp_profile({twobitfile,name[,region]},motif_profile,pct_ident,...)
  *
  *  returns indicies in seq1 where motif_profile has >= pct_ident 
  *  percentage of characters in common counting reverse-compliments 
- *  and excluding overlaping words
+ *  and excluding overlaping words (an int64 row)
  * 
  *  motif_profile is a 4 x N matrix of nucleotide counts with 
  *      N = motif length and nucleotides order A C G T  
  *
+ *  a logical mask, one per column, makes a gapped motif: only the
+ *  columns where mask is true (and the matching columns of the reverse
+ *  compliment) are scored and the score is normalized by their number,
+ *  the others are don't-care and may hold anything (e.g. zeros for the
+ *  spacer of a bipartite site). a window still spans all N columns.
+ *
+ *  optional outputs give the strand of each hit (1 = motif_profile as 
+ *  given, -1 = reverse compliment, the better scoring one if both pass)
+ *  and its normalized profile score on that strand
+ *
+ *  the optional stats output holds the work done and the time spent
+ *  in each phase (see callstats.h). the scan is the same as without
+ *  it; for hits_raw the windows overlapping a hit, which the scan
+ *  skips, are scored apart, outside windows, abandoned and the phase
+ *  times.
+ *
+ *  sharded mode: scans only the windows starting in region = [first last]
+ *  (1-based) and writes every window passing pct_ident to partfile 
+ *  (see shardio.h) with its strand and score. shardmerge removes
+ *  overlaps across all parts.
+ *
+ *  seq1 can be a .2bit sequence {twobitfile,name} or region of one
+ *  {twobitfile,name,[first last]} (see twobit.h); indicies then count
+ *  from the first base read.
+ *
  *  Brian Kolterman 8/2012
  *
  *=================================================================*/
 
 
 #include <stdio.h>
-#include <string.h> /* strlen */
+#include <string.h> /* strlen, memcpy */
 #include "mex.h"
+#include "shardio.h"
+#include "twobit.h"
+#include "hitbuf.h"
+#include "phaseprof.h"
+#include "callstats.h"
 
 
 #define PID     prhs[2]
 #define OUT     plhs[0]
+#define STRAND  plhs[1]
+#define SCORE   plhs[2]
+#define STATS   plhs[3]
+#define REG     prhs[3]
+#define PART    prhs[4]
 #define MAX      30
-#define MAXSEQ   10000
 
 
 void RevComp(double *substr, double *substrR, mwSize smotif);
-void seqToInt(char *seqstr, int *seq, mwSize seqlen);
+void seqToInt(char *seqstr, unsigned char *seq, mwSize seqlen);
+double MaxOf4(const double *col);
+mwSize MaskOffsets(const mxArray *mask, mwSize lSt2, mwSize *off, mwSize *offR);
+mwSize OverlapHits(const unsigned char *sequence, const double *motif_profile, const double *motif_profileR, const mwSize *off, const mwSize *offR, mwSize nInf, mwSize iFrom, mwSize iTo, double pct_ident);
+
 
 void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 {
     char    *str1;
-    int     lSt1, iPos, iCh, iLast, nHits;
-    double  *motif_profile, *motif_profileR, score, scoreR, pct_ident, *ind;
-    int     *indTemp, i, *sequence;
+    mwSize  lSt1, iPos, iCh, iLast;
+    long long nHits;
+    double  *motif_profile, *motif_profileR, score, scoreR, pct_ident;
+    double  *sufMax, *sufMaxR, need;
+    mwSize  nInf, *off, *offR;
+    const mxArray *mask;
+    HitBuf  hits;
+    mwSize  i, iFirst, iEnd;
+    unsigned char *sequence;
+    char    *fname;
+    FILE    *fid;
+    ShardHit hit;
+    bool    rawHits;
+    CallStats st;
+    PROF_DECLARE
     mwSize  lSt2;
     
-    // Check for correct number of arguments     
+    // Check for correct number of arguments, a trailing logical is 
+    // the mask of a gapped motif
     
-    if (nrhs != 3) 
+    mask = NULL;
+    
+    if (nrhs > 3 && mxIsLogical(prhs[nrhs-1]))
     {
-        mexErrMsgTxt("Usage: ind = motifind_revcomp_profile(seq1,motif_profile,pct_ident)\n");
+        mask = prhs[--nrhs];
+    }
+    
+    if (nrhs != 3 && nrhs != 5) 
+    {
+        mexErrMsgTxt("Usage: [ind,strand,score,stats] = motifind_revcomp_profile(seq1,motif_profile,pct_ident[,mask]) or nhits = motifind_revcomp_profile(seq1,motif_profile,pct_ident,region,partfile[,mask])\n");
     } 
-    if (nlhs > 1)
+    if (nlhs > 4 || (nlhs > 1 && nrhs == 5))
     {
-        mexErrMsgTxt("Usage: ind = motifind_revcomp_profile(seq1,motif_profile,pct_ident)\n");
+        mexErrMsgTxt("Usage: [ind,strand,score,stats] = motifind_revcomp_profile(seq1,motif_profile,pct_ident[,mask]) or nhits = motifind_revcomp_profile(seq1,motif_profile,pct_ident,region,partfile[,mask])\n");
     }
     
+    StatsInit(&st);
+    StatsPhase(&st, PP_ENCODE);
+    PROF_START();
+    PROF_PHASE(PP_ENCODE);
+    
     // Check to be sure inputs are correct
     
-    if (!(mxIsChar(prhs[0])))
+    if (!(mxIsChar(prhs[0])) && !(mxIsCell(prhs[0])))
     {
-        mexErrMsgTxt("seq1 must be of type string.\n.");
+        mexErrMsgTxt("seq1 must be a string or {twobitfile,name[,region]}.\n.");
     }
     
     if (!(mxIsDouble(prhs[1])) || !(mxGetM(prhs[1]) == 4))
@@ -64,16 +131,11 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
     
     
     
-    str1=mxArrayToString(prhs[0]);
+    str1 = mxIsCell(prhs[0]) ? TwoBitCellToString(prhs[0]) : mxArrayToString(prhs[0]);
     
-    lSt1 = (int)strlen(str1);
+    lSt1 = strlen(str1);
     lSt2 = (mwSize)mxGetN(prhs[1]);
     
-    if (lSt1 > MAXSEQ)
-    {
-        mexErrMsgTxt("seq1 must be <= 10000 bp.\n.");
-    }
-    
     if (lSt2 > MAX)
     {
         mexErrMsgTxt("motif_length must be <= 30.\n.");
@@ -84,7 +146,7 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
     
     // convert main nuc. sequence into an integer array
     
-    sequence = (int*)mxCalloc(lSt1,sizeof(int));
+    sequence = (unsigned char*)mxCalloc(lSt1 > 0 ? lSt1 : 1,sizeof(unsigned char));
     
     seqToInt(str1,sequence,lSt1);
    
@@ -93,15 +155,24 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
     motif_profile = (double*)mxCalloc(4*lSt2,sizeof(double));
     motif_profileR = (double*)mxCalloc(4*lSt2,sizeof(double));
    
-    motif_profile=mxGetPr(prhs[1]);
+    memcpy(motif_profile, mxGetPr(prhs[1]), 4*lSt2*sizeof(double));
+    
+    
+    // Offsets of the informative columns of both strands, all of them
+    // without a mask
+    
+    off = (mwSize*)mxCalloc(lSt2 > 0 ? lSt2 : 1,sizeof(mwSize));
+    offR = (mwSize*)mxCalloc(lSt2 > 0 ? lSt2 : 1,sizeof(mwSize));
+    
+    nInf = MaskOffsets(mask, lSt2, off, offR);
    
     
      
-    // normalize profile
+    // normalize profile, don't-care columns are never read
     
-    for (iPos = 0; iPos < lSt2; iPos++) 
+    for (iCh = 0; iCh < nInf; iCh++) 
     {
-        i = iPos*4;
+        i = off[iCh]*4;
         score = motif_profile[i] + motif_profile[i+1] + motif_profile[i+2] + motif_profile[i+3];
         
         motif_profile[i] /= score;
@@ -132,67 +203,202 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
         mexErrMsgTxt("pct_ident must be a scalar 0< pct_ident <=1 .\n.");
     }
     
-  
+    st.bytes = lSt1;
+    
+    
+    // Best score still reachable from each motif position on, scoring 
+    // of a window is abandoned once neither strand can reach pct_ident.
+    // the margin keeps rounding from abandoning a window that passes
     
+    sufMax = (double*)mxCalloc(lSt2+1,sizeof(double));
+    sufMaxR = (double*)mxCalloc(lSt2+1,sizeof(double));
     
+    for (iCh = nInf; iCh-- > 0; )
+    {
+        sufMax[iCh] = sufMax[iCh+1] + MaxOf4(motif_profile + 4*off[iCh]);
+        sufMaxR[iCh] = sufMaxR[iCh+1] + MaxOf4(motif_profileR + 4*offR[iCh]);
+    }
     
-    // Set up temproary storage for hit indicies
+    need = pct_ident*(double)nInf - 1e-9*(double)nInf;
+    
+  
     
-    indTemp = (int*)mxCalloc(lSt1,sizeof(int));
+    
+    
+    // Region of windows to scan, the whole sequence unless sharded
     
     iLast = (lSt1 - lSt2 + 1);
     
+    iFirst = 0;
+    iEnd = iLast;
+    fid = NULL;
+    
+    if (nrhs == 5)
+    {
+        if (!mxIsDouble(REG) || mxGetNumberOfElements(REG) != 2 || !mxIsChar(PART))
+        {
+            mexErrMsgTxt("region must be [first last] and partfile a string.\n.");
+        }
+        
+        if (mxGetPr(REG)[0] < 1 || mxGetPr(REG)[1] < mxGetPr(REG)[0] || mxGetPr(REG)[1] > (double)iLast)
+        {
+            mexErrMsgTxt("region must lie within 1 and length(seq1)-motif_length+1.\n.");
+        }
+        
+        iFirst = (mwSize)mxGetPr(REG)[0] - 1;
+        iEnd = (mwSize)mxGetPr(REG)[1];
+        
+        fname = mxArrayToString(PART);
+        fid = ShardOpen(fname, SHARD_SCORED, lSt2, iFirst + 1, iEnd, iLast);
+        mxFree(fname);
+        
+        if (fid == NULL)
+        {
+            mexErrMsgTxt("could not open partfile for writing.\n.");
+        }
+    }
+    
+    
+    // Set up growable storage for hits
+    
+    HitInit(&hits, 1);
+    
     nHits = 0;
     
+    rawHits = (nlhs > 3);
+    
+    StatsPhase(&st, PP_SCAN);
+    PROF_PHASE(PP_SCAN);
+    
     
     // Do the comparison
     
-    for (iPos = 0; iPos < iLast; iPos++)
+    for (iPos = iFirst; iPos < iEnd; iPos++)
     {
         score = 0.0;
         scoreR = 0.0;
+        st.windows++;
         
         
-        for (iCh = 0; iCh < lSt2; iCh++)
+        for (iCh = 0; iCh < nInf; iCh++)
         {
             
-            i = sequence[iCh+iPos] + iCh*4;
+            score += motif_profile[sequence[off[iCh]+iPos] + off[iCh]*4];
+            scoreR += motif_profileR[sequence[offR[iCh]+iPos] + offR[iCh]*4];
             
-            score += motif_profile[i];
-            scoreR += motif_profileR[i];
+            if (iCh+1 < nInf && score + sufMax[iCh+1] < need && scoreR + sufMaxR[iCh+1] < need) break;
         
         }
         
+        if (iCh < nInf)
+        {
+            st.abandoned++;
+            continue;
+        }
+        
         
-        score = score/(double)lSt2;
-        scoreR = scoreR/(double)lSt2;
+        score = score/(double)nInf;
+        scoreR = scoreR/(double)nInf;
         
         if (score >= pct_ident || scoreR >= pct_ident)
         {
-            indTemp[nHits] = iPos+1;
+            st.hitsRaw++;
+            
+            // sharded: keep every passing window, overlaps are removed 
+            // by shardmerge
+            
+            if (fid != NULL)
+            {
+                hit.pos = iPos+1;
+                hit.strand = (score >= scoreR) ? 1.0 : -1.0;
+                hit.score = (score >= scoreR) ? score : scoreR;
+                fwrite(&hit, sizeof(hit), 1, fid);
+                nHits++;
+                continue;
+            }
+            
+            if (score >= scoreR)
+            {
+                HitAdd(&hits, (long long)iPos+1, 1.0, score);
+            }
+            else
+            {
+                HitAdd(&hits, (long long)iPos+1, -1.0, scoreR);
+            }
             nHits++;
+            
+            // the skipped overlapping windows, for hits_raw only
+            
+            if (rawHits)
+            {
+                StatsPhase(&st, PP_NONE);
+                PROF_PHASE(PP_NONE);
+                st.hitsRaw += OverlapHits(sequence, motif_profile, motif_profileR, off, offR, nInf, iPos+1, iPos+lSt2 < iEnd ? iPos+lSt2 : iEnd, pct_ident);
+                StatsPhase(&st, PP_SCAN);
+                PROF_PHASE(PP_SCAN);
+            }
+            
             iPos += (lSt2-1);
         }
     }
     
+    StatsPhase(&st, PP_OUTPUT);
+    PROF_PHASE(PP_OUTPUT);
+    
+    if (fid != NULL)
+    {
+        if (!ShardClose(fid, nHits))
+        {
+            mexErrMsgTxt("error writing partfile.\n.");
+        }
+        
+        OUT = mxCreateDoubleScalar((double)nHits);
+        HitFree(&hits);
+        
+        mxFree(str1);
+        mxFree(sufMax);
+        mxFree(sufMaxR);
+        mxFree(off);
+        mxFree(offR);
+        mxFree(motif_profile);
+        mxFree(motif_profileR);
+        PROF_REPORT("motifind_revcomp_profile", lSt1);
+        return;
+    }
+    
      
     
-    // Remove extra zeros 
+    // Copy hit columns to the outputs
     
-    OUT = mxCreateDoubleMatrix(1, nHits, mxREAL);
+    OUT = HitPositions(&hits);
     
-    ind = mxGetPr(OUT);
- 
+    if (nlhs > 1)
+    {
+        STRAND = HitStrands(&hits);
+    }
     
-    for (iPos = 0; iPos < nHits; iPos++)
+    if (nlhs > 2)
     {
-        
-        ind[iPos] = indTemp[iPos];
+        SCORE = HitScores(&hits);
     }
     
-   
+    if (nlhs > 3)
+    {
+        st.hits = nHits;
+        STATS = StatsToArray(&st);
+    }
+    
+    HitFree(&hits);
     mxFree(str1);
+    mxFree(sufMax);
+    mxFree(sufMaxR);
+    mxFree(off);
+    mxFree(offR);
+    mxFree(motif_profile);
+    mxFree(motif_profileR);
    
+    PROF_REPORT("motifind_revcomp_profile", lSt1);
+    
     return;
 }
 
@@ -203,7 +409,7 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 void RevComp(double *substr, double *substrR, mwSize smotif)
 {
     
-    int i,j,k;
+    mwSize i,j,k;
     
     for (i = 0; i < smotif; i++)
     {
@@ -217,9 +423,9 @@ void RevComp(double *substr, double *substrR, mwSize smotif)
 }
 
 
-void seqToInt(char *seqstr, int *seq, mwSize seqlen) {
+void seqToInt(char *seqstr, unsigned char *seq, mwSize seqlen) {
     
-    int i;
+    mwSize i;
     
     for (i = 0; i < seqlen; i++) 
     {
@@ -246,3 +452,82 @@ void seqToInt(char *seqstr, int *seq, mwSize seqlen) {
     }
     
 }
+
+
+// largest of the four base frequencies of a profile column
+
+double MaxOf4(const double *col)
+{
+    double m = col[0];
+    
+    if (col[1] > m) m = col[1];
+    if (col[2] > m) m = col[2];
+    if (col[3] > m) m = col[3];
+    
+    return m;
+}
+
+
+// MaskOffsets lists the columns of a profile of lSt2 columns that
+// mask (NULL = all) marks informative in off, and in offR those of 
+// its reverse compliment (the mask reversed), returns their number
+
+mwSize MaskOffsets(const mxArray *mask, mwSize lSt2, mwSize *off, mwSize *offR)
+{
+    mwSize  iCh, nInf;
+    mxLogical *m;
+    
+    if (mask != NULL && mxGetNumberOfElements(mask) != lSt2)
+    {
+        mexErrMsgTxt("mask must have one element per profile column.\n.");
+    }
+    
+    m = (mask != NULL) ? mxGetLogicals(mask) : NULL;
+    nInf = 0;
+    
+    for (iCh = 0; iCh < lSt2; iCh++)
+    {
+        if (m == NULL || m[iCh]) off[nInf++] = iCh;
+    }
+    
+    for (iCh = 0; iCh < nInf; iCh++)
+    {
+        offR[iCh] = lSt2 - 1 - off[nInf - 1 - iCh];
+    }
+    
+    if (nInf == 0 && lSt2 > 0)
+    {
+        mexErrMsgTxt("mask must keep at least one profile column.\n.");
+    }
+    
+    return nInf;
+}
+
+
+// number of windows iFrom..iTo-1 passing pct_ident on either strand,
+// the windows after a hit that the scan skips, scored only for the
+// hits_raw stat
+
+mwSize OverlapHits(const unsigned char *sequence, const double *motif_profile, const double *motif_profileR, const mwSize *off, const mwSize *offR, mwSize nInf, mwSize iFrom, mwSize iTo, double pct_ident)
+{
+    mwSize iPos, iCh, n;
+    double score, scoreR;
+    
+    n = 0;
+    
+    for (iPos = iFrom; iPos < iTo; iPos++)
+    {
+        score = 0.0;
+        scoreR = 0.0;
+        
+        for (iCh = 0; iCh < nInf; iCh++)
+        {
+            score += motif_profile[sequence[off[iCh]+iPos] + off[iCh]*4];
+            scoreR += motif_profileR[sequence[offR[iCh]+iPos] + offR[iCh]*4];
+        }
+        
+        if (score/(double)nInf >= pct_ident || scoreR/(double)nInf >= pct_ident) n++;
+    }
+    
+    return n;
+}
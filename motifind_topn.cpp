@@ -0,0 +1,450 @@
+/*=================================================================
+ *  motifind_topn.cpp
+ *
+ *  [ind,strand,score] = motifind_topn(seq1,motif,n)
+ *  [ind,strand,score,stats] = motifind_topn(seq1,motif,n)
+ *
+ *  returns the n best scoring non-overlapping windows of seq1 for a
+ *  motif, counting reverse compliments, without a pct_ident threshold.
+ *  motif is either a string, scored as motifind_revcomp (percentage of
+ *  characters in common), or a 4 x N profile of nucleotide counts
+ *  (order A C G T), scored as motifind_revcomp_profile (bases other
+ *  than A C G T score as A, as there).
+ *
+ *  windows are picked best first: the best window, then the best one
+ *  not overlapping it, and so on, ties going to the leftmost. ind (an
+ *  int64 row), strand (1 / -1, the better strand) and score are in
+ *  that order, best first. fewer than n are returned when seq1 has
+ *  no more non-overlapping windows.
+ *
+ *  seq1 may be a cell array of strings, the outputs are then cell
+ *  arrays with the windows of each sequence.
+ *
+ *  the best n*(2*N-1) windows always hold the n picked ones, as each
+ *  pick excludes at most 2*N-2 windows. only those are kept, in a heap
+ *  whose worst score is the bar a window must beat, so scoring of most
+ *  windows is abandoned early once the heap is full. the optional
+ *  stats output (see callstats.h) counts as hits_raw the windows that
+ *  entered the heap.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h> /* strlen */
+#include <vector>
+#include <algorithm>
+#include "mex.h"
+#include "hitbuf.h"
+#include "callstats.h"
+
+
+#define SEQ     prhs[0]
+#define MOTIF   prhs[1]
+#define NTOP    prhs[2]
+#define OUT     plhs[0]
+#define STRAND  plhs[1]
+#define SCORE   plhs[2]
+#define STATS   plhs[3]
+
+
+// a scored window, score is the match count or profile sum
+
+struct Cand
+{
+    double  score;
+    mwSize  pos;
+    int     strand;
+};
+
+// heap order: a before b if a is the better window, so the heap top
+// is the worst window kept
+
+bool Better(const Cand &a, const Cand &b)
+{
+    return a.score > b.score || (a.score == b.score && a.pos < b.pos);
+}
+
+
+struct TopMotif
+{
+    bool    isProf;
+    mwSize  len;
+    char    *str, *strR;                    /* string motif */
+    std::vector<double> prof, profR;        /* 4 x len frequencies */
+    std::vector<double> sufMax, sufMaxR;
+};
+
+
+void RevComp(char *substr, char *substrR);
+void RevCompProfile(const double *substr, double *substrR, mwSize smotif);
+double MaxOf4(const double *col);
+void TopWindows(const char *str1, TopMotif *mo, mwSize nTop, HitBuf *hits, CallStats *st);
+
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *str1;
+    const mxArray *cell;
+    mwSize  nSeq, iSeq, nTop, iPos, iCh;
+    double  *counts, sum;
+    TopMotif mo;
+    HitBuf  hits;
+    CallStats st;
+
+
+    // Check for correct number of arguments
+
+    if (nrhs != 3)
+    {
+        mexErrMsgTxt("Usage: [ind,strand,score,stats] = motifind_topn(seq1,motif,n)\n");
+    }
+    if (nlhs > 4)
+    {
+        mexErrMsgTxt("Usage: [ind,strand,score,stats] = motifind_topn(seq1,motif,n)\n");
+    }
+
+    StatsInit(&st);
+    StatsPhase(&st, PP_ENCODE);
+
+    // Check to be sure inputs are correct
+
+    if (!mxIsChar(SEQ) && !mxIsCell(SEQ))
+    {
+        mexErrMsgTxt("seq1 must be a string or a cell array of strings.\n.");
+    }
+
+    if (mxGetNumberOfElements(NTOP) != 1 || mxGetScalar(NTOP) < 1)
+    {
+        mexErrMsgTxt("n must be a positive scalar.\n.");
+    }
+
+    nTop = (mwSize)mxGetScalar(NTOP);
+
+
+    // Motif: a string, or a 4 x N profile normalized to frequencies,
+    // bases other than A C G T are encoded and scored as A
+
+    mo.str = mo.strR = NULL;
+    mo.isProf = !mxIsChar(MOTIF);
+
+    if (mo.isProf)
+    {
+        if (!mxIsDouble(MOTIF) || mxGetM(MOTIF) != 4 || mxGetN(MOTIF) < 1)
+        {
+            mexErrMsgTxt("motif must be a string or a 4 X motif_length double matrix (order ACGT).\n.");
+        }
+
+        mo.len = mxGetN(MOTIF);
+        counts = mxGetPr(MOTIF);
+
+        mo.prof.assign(4*mo.len, 0.0);
+        mo.profR.assign(4*mo.len, 0.0);
+
+        for (iPos = 0; iPos < mo.len; iPos++)
+        {
+            sum = counts[4*iPos] + counts[4*iPos+1] + counts[4*iPos+2] + counts[4*iPos+3];
+
+            for (iCh = 0; iCh < 4; iCh++)
+            {
+                mo.prof[4*iPos+iCh] = counts[4*iPos+iCh]/sum;
+            }
+        }
+
+        RevCompProfile(&mo.prof[0], &mo.profR[0], mo.len);
+
+
+        // Best sum still reachable from each motif position on
+
+        mo.sufMax.assign(mo.len+1, 0.0);
+        mo.sufMaxR.assign(mo.len+1, 0.0);
+
+        for (iPos = mo.len; iPos-- > 0; )
+        {
+            mo.sufMax[iPos] = mo.sufMax[iPos+1] + MaxOf4(&mo.prof[4*iPos]);
+            mo.sufMaxR[iPos] = mo.sufMaxR[iPos+1] + MaxOf4(&mo.profR[4*iPos]);
+        }
+    }
+    else
+    {
+        mo.str = mxArrayToString(MOTIF);
+        mo.strR = mxArrayToString(MOTIF);
+        mo.len = strlen(mo.str);
+
+        RevComp(mo.str, mo.strR);
+
+        if (mo.len < 1)
+        {
+            mexErrMsgTxt("motif must not be empty.\n.");
+        }
+    }
+
+
+    // Best windows of each sequence
+
+    nSeq = mxIsCell(SEQ) ? mxGetNumberOfElements(SEQ) : 1;
+
+    if (mxIsCell(SEQ))
+    {
+        OUT = mxCreateCellMatrix(1, nSeq);
+        if (nlhs > 1) STRAND = mxCreateCellMatrix(1, nSeq);
+        if (nlhs > 2) SCORE = mxCreateCellMatrix(1, nSeq);
+    }
+
+    for (iSeq = 0; iSeq < nSeq; iSeq++)
+    {
+        cell = mxIsCell(SEQ) ? mxGetCell(SEQ, iSeq) : SEQ;
+
+        if (cell == NULL || !mxIsChar(cell))
+        {
+            mexErrMsgTxt("seq1 must be a string or a cell array of strings.\n.");
+        }
+
+        str1 = mxArrayToString(cell);
+
+        HitInit(&hits, 1);
+
+        TopWindows(str1, &mo, nTop, &hits, &st);
+
+        StatsPhase(&st, PP_OUTPUT);
+
+        if (mxIsCell(SEQ))
+        {
+            mxSetCell(OUT, iSeq, HitPositions(&hits));
+            if (nlhs > 1) mxSetCell(STRAND, iSeq, HitStrands(&hits));
+            if (nlhs > 2) mxSetCell(SCORE, iSeq, HitScores(&hits));
+        }
+        else
+        {
+            OUT = HitPositions(&hits);
+            if (nlhs > 1) STRAND = HitStrands(&hits);
+            if (nlhs > 2) SCORE = HitScores(&hits);
+        }
+
+        st.hits += hits.n;
+
+        HitFree(&hits);
+        mxFree(str1);
+
+        StatsPhase(&st, PP_ENCODE);
+    }
+
+    if (nlhs > 3)
+    {
+        STATS = StatsToArray(&st);
+    }
+
+    mxFree(mo.str);
+    mxFree(mo.strR);
+
+    return;
+}
+
+
+
+// TopWindows scores every window of str1 on both strands, keeping the
+// best nTop*(2*len-1) in a heap, then picks the non-overlapping ones
+// best first into hits
+
+void TopWindows(const char *str1, TopMotif *mo, mwSize nTop, HitBuf *hits, CallStats *st)
+{
+    std::vector<unsigned char> seq;
+    std::vector<Cand> heap;
+    std::vector<mwSize> picked;
+    std::vector<mwSize>::iterator at;
+    mwSize  lSt1, m, nWin, nKeep, iPos, iCh, i;
+    long long nMis, nMisR, maxMis;
+    double  score, scoreR, bar, margin;
+    bool    full;
+    Cand    c;
+
+    lSt1 = strlen(str1);
+    m = mo->len;
+
+    if (lSt1 < m) return;
+
+    nWin = lSt1 - m + 1;
+    nKeep = (nTop < nWin/(2*m-1) + 1) ? nTop*(2*m-1) : nWin;
+
+    st->bytes += lSt1;
+
+    if (mo->isProf)
+    {
+        seq.resize(lSt1);
+
+        for (iPos = 0; iPos < lSt1; iPos++)
+        {
+            switch (str1[iPos])
+            {
+                case 'A': seq[iPos] = 0; break;
+                case 'C': seq[iPos] = 1; break;
+                case 'G': seq[iPos] = 2; break;
+                case 'T': seq[iPos] = 3; break;
+                default:  seq[iPos] = 0; break;
+            }
+        }
+    }
+
+    StatsPhase(st, PP_SCAN);
+
+    heap.reserve(nKeep + 1);
+    full = false;
+    bar = -1.0;
+    maxMis = (long long)m;
+    margin = 1e-9*(double)m;
+
+    for (iPos = 0; iPos < nWin; iPos++)
+    {
+        st->windows++;
+        score = scoreR = 0.0;
+
+        if (mo->isProf)
+        {
+            // abandoned once neither strand can beat the worst kept
+            // window, with a margin for rounding
+
+            for (iCh = 0; iCh < m; iCh++)
+            {
+                i = 4*iCh + seq[iPos+iCh];
+
+                score += mo->prof[i];
+                scoreR += mo->profR[i];
+
+                if (full && iCh+1 < m && score + mo->sufMax[iCh+1] < bar - margin
+                    && scoreR + mo->sufMaxR[iCh+1] < bar - margin) break;
+            }
+        }
+        else
+        {
+            // a window needs more matches than the worst kept one, ties
+            // lose to it as it lies further left
+
+            nMis = nMisR = 0;
+
+            for (iCh = 0; iCh < m; iCh++)
+            {
+                if (str1[iPos+iCh] != mo->str[iCh]) nMis++;
+                if (str1[iPos+iCh] != mo->strR[iCh]) nMisR++;
+
+                if (nMis > maxMis && nMisR > maxMis) break;
+            }
+
+            score = (double)((long long)m - nMis);
+            scoreR = (double)((long long)m - nMisR);
+        }
+
+        if (iCh < m)
+        {
+            st->abandoned++;
+            continue;
+        }
+
+        c.pos = iPos;
+        c.strand = (score >= scoreR) ? 1 : -1;
+        c.score = (score >= scoreR) ? score : scoreR;
+
+        if (full && !Better(c, heap.front())) continue;
+
+        st->hitsRaw++;
+
+        heap.push_back(c);
+        std::push_heap(heap.begin(), heap.end(), Better);
+
+        if (heap.size() > nKeep)
+        {
+            std::pop_heap(heap.begin(), heap.end(), Better);
+            heap.pop_back();
+        }
+
+        if (heap.size() == nKeep)
+        {
+            full = true;
+            bar = heap.front().score;
+
+            if (!mo->isProf) maxMis = (long long)m - (long long)bar - 1;
+        }
+    }
+
+    StatsPhase(st, PP_RESOLVE);
+
+
+    // Pick best first, skipping windows overlapping a picked one
+
+    std::sort(heap.begin(), heap.end(), Better);
+
+    for (i = 0; i < heap.size() && (mwSize)hits->n < nTop; i++)
+    {
+        at = std::lower_bound(picked.begin(), picked.end(), heap[i].pos);
+
+        if (at != picked.end() && *at < heap[i].pos + m) continue;
+        if (at != picked.begin() && *(at-1) + m > heap[i].pos) continue;
+
+        picked.insert(at, heap[i].pos);
+        HitAdd(hits, (long long)heap[i].pos + 1, (double)heap[i].strand, heap[i].score/(double)m);
+    }
+}
+
+
+
+void RevComp(char *substr, char *substrR)
+{
+    int i, smotif;
+    smotif = strlen(substr);
+
+    for (i = 0; i < smotif; i++)
+    {
+        switch  (substr[smotif-i-1])
+        {
+            case 'A':
+            substrR[i] = 'T';
+            break;
+
+            case 'T':
+            substrR[i] = 'A';
+            break;
+
+            case 'C':
+            substrR[i] = 'G';
+            break;
+
+            case 'G':
+            substrR[i] = 'C';
+            break;
+        }
+    }
+
+}
+
+
+// RevCompProfile takes a profile (4 x smotif, order ACGT) and returns
+// its reverse compliment in substrR
+
+void RevCompProfile(const double *substr, double *substrR, mwSize smotif)
+{
+    mwSize i, j, k;
+
+    for (i = 0; i < smotif; i++)
+    {
+        j = i*4;
+        k = (smotif-i-1)*4;
+        substrR[k] = substr[j+3];
+        substrR[k+1] = substr[j+2];
+        substrR[k+2] = substr[j+1];
+        substrR[k+3] = substr[j];
+    }
+}
+
+
+// largest of the four base frequencies of a profile column
+
+double MaxOf4(const double *col)
+{
+    double m = col[0];
+
+    if (col[1] > m) m = col[1];
+    if (col[2] > m) m = col[2];
+    if (col[3] > m) m = col[3];
+
+    return m;
+}
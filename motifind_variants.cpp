@@ -0,0 +1,431 @@
+/*=================================================================
+ *  motifind_variants.cpp
+ *
+ *  [gained,lost] = motifind_variants(seq1,motif_profile,pct_ident,ind,variants)
+ *  [gained,lost] = motifind_variants({twobitfile,name[,region]},...)
+ *
+ *  motif hits gained and lost by each of a batch of sequence variants,
+ *  scored as in motifind_revcomp_profile
+ *
+ *  ind is the hit set of motifind_revcomp_profile(seq1,motif_profile,
+ *  pct_ident), int64 or double. variants is an n x 3 cell array of
+ *  {pos, ref, alt}: the ref allele starting at 1-based position pos of
+ *  seq1 is replaced by alt ('' or '-' for an empty allele, so SNPs,
+ *  insertions, deletions and substitutions of any length can be
+ *  given). every variant is applied to seq1 on its own.
+ *
+ *  gained holds one row [variant position strand score] per hit of the
+ *  edited sequence that seq1 does not have (position in edited sequence
+ *  coordinates), lost one row [variant position] per hit of ind that
+ *  the edited sequence does not have.
+ *
+ *  only windows overlapping the edit are rescored. the greedy
+ *  non-overlap selection is the same as in seq1 up to the first of
+ *  them, and again from the first position after the edit where
+ *  neither the edited nor the original selection is blocked by a hit,
+ *  so the rescan stops there. the cost per variant is a few motif
+ *  lengths of windows, not the length of seq1.
+ *
+ *  seq1 can be a .2bit sequence {twobitfile,name} or region of one
+ *  {twobitfile,name,[first last]} (see twobit.h), ind and pos are then
+ *  relative to the first base read, as in motifind_revcomp_profile.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h> /* strlen */
+#include <vector>
+#include <algorithm>
+#include "mex.h"
+#include "twobit.h"
+
+
+#define SEQ     prhs[0]
+#define PROF    prhs[1]
+#define PID     prhs[2]
+#define IND     prhs[3]
+#define VARS    prhs[4]
+#define GAINED  plhs[0]
+#define LOST    plhs[1]
+
+
+void RevComp(double *substr, double *substrR, mwSize smotif);
+void seqToInt(char *seqstr, unsigned char *seq, mwSize seqlen);
+
+// one variant applied to the encoded reference
+
+typedef struct
+{
+    const unsigned char *seq;   // encoded reference
+    long long pos;              // 0-based start of the edit
+    int     lRef, lAlt;         // allele lengths
+    const unsigned char *alt;   // encoded alt allele
+} Variant;
+
+int  VarBase(const Variant *v, long long x);
+int  GetAllele(const mxArray *a, char *buf, int max);
+
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *str1, *ref, *alt;
+    int     lSt2, lVar, iPos, iCh, iVar, nVar, delta, lShared;
+    long long lSt1, nBase, iBase, i, x, xs, iFirst, varNext, baseNext, iResync;
+    double  *motif_profile, *motif_profileR, *out, score, scoreR, pct_ident;
+    unsigned char *sequence, *altCode;
+    std::vector<long long> base, varHits, mapped;
+    std::vector<double> gained, lost, varStrand, varScore;
+    Variant v;
+
+
+    // Check for correct number of arguments
+
+    if (nrhs != 5)
+    {
+        mexErrMsgTxt("Usage: [gained,lost] = motifind_variants(seq1,motif_profile,pct_ident,ind,variants)\n");
+    }
+    if (nlhs > 2)
+    {
+        mexErrMsgTxt("Usage: [gained,lost] = motifind_variants(seq1,motif_profile,pct_ident,ind,variants)\n");
+    }
+
+    // Check to be sure inputs are correct
+
+    if (!(mxIsChar(SEQ)) && !(mxIsCell(SEQ)))
+    {
+        mexErrMsgTxt("seq1 must be a string or {twobitfile,name[,region]}.\n.");
+    }
+
+    if (!(mxIsDouble(PROF)) || !(mxGetM(PROF) == 4) || mxGetN(PROF) < 1)
+    {
+        mexErrMsgTxt("motif_profile must be 4 X motif_length double matrix (order ACGT).\n.");
+    }
+
+    if (mxGetNumberOfElements(PID) != 1)
+    {
+        mexErrMsgTxt("pct_ident must be a scalar 0< pct_ident <=1 .\n.");
+    }
+
+    pct_ident = mxGetScalar(PID);
+
+    if ((pct_ident <= 0) || (pct_ident > 1))
+    {
+        mexErrMsgTxt("pct_ident must be a scalar 0< pct_ident <=1 .\n.");
+    }
+
+    if (!mxIsDouble(IND) && mxGetClassID(IND) != mxINT64_CLASS)
+    {
+        mexErrMsgTxt("ind must be the hit indicies of motifind_revcomp_profile.\n.");
+    }
+
+    if (!mxIsCell(VARS) || (mxGetNumberOfElements(VARS) > 0 && mxGetN(VARS) != 3))
+    {
+        mexErrMsgTxt("variants must be an n x 3 cell array of {pos, ref, alt}.\n.");
+    }
+
+    str1 = mxIsCell(SEQ) ? TwoBitCellToString(SEQ) : mxArrayToString(SEQ);
+
+    lSt1 = (long long)strlen(str1);
+    lSt2 = (int)mxGetN(PROF);
+
+    sequence = (unsigned char*)mxCalloc(lSt1 > 0 ? lSt1 : 1,sizeof(unsigned char));
+
+    seqToInt(str1,sequence,lSt1);
+
+
+    // normalized copy of the profile and its reverse compliment
+
+    motif_profile = (double*)mxCalloc(4*lSt2,sizeof(double));
+    motif_profileR = (double*)mxCalloc(4*lSt2,sizeof(double));
+
+    memcpy(motif_profile, mxGetPr(PROF), 4*lSt2*sizeof(double));
+
+    for (iPos = 0; iPos < lSt2; iPos++)
+    {
+        i = iPos*4;
+        score = motif_profile[i] + motif_profile[i+1] + motif_profile[i+2] + motif_profile[i+3];
+
+        motif_profile[i] /= score;
+        motif_profile[i+1] /= score;
+        motif_profile[i+2] /= score;
+        motif_profile[i+3] /= score;
+    }
+
+    RevComp(motif_profile,motif_profileR,lSt2);
+
+
+    // baseline hits (int64 or double), 0-based and ascending
+
+    nBase = (long long)mxGetNumberOfElements(IND);
+
+    base.resize(nBase);
+
+    for (i = 0; i < nBase; i++)
+    {
+        if (mxIsDouble(IND)) base[i] = (long long)mxGetPr(IND)[i] - 1;
+        else base[i] = ((const long long*)mxGetData(IND))[i] - 1;
+
+        if (base[i] < 0 || base[i] > lSt1 - lSt2 || (i > 0 && base[i] < base[i-1] + lSt2))
+        {
+            mexErrMsgTxt("ind must be the hit indicies of motifind_revcomp_profile.\n.");
+        }
+    }
+
+    nVar = (int)(mxGetNumberOfElements(VARS)/3);
+
+
+
+    // Rescan around every variant
+
+    for (iVar = 0; iVar < nVar; iVar++)
+    {
+        if (mxGetCell(VARS,iVar) == NULL || mxGetNumberOfElements(mxGetCell(VARS,iVar)) != 1)
+        {
+            mexErrMsgTxt("variant pos must be a scalar.\n.");
+        }
+
+        v.seq = sequence;
+        v.pos = (long long)mxGetScalar(mxGetCell(VARS,iVar)) - 1;
+        lVar = mxGetCell(VARS,iVar+nVar) ? (int)mxGetNumberOfElements(mxGetCell(VARS,iVar+nVar)) : 0;
+        ref = (char*)mxCalloc(lVar + 2,sizeof(char));
+        v.lRef = GetAllele(mxGetCell(VARS,iVar+nVar), ref, lVar + 1);
+
+        if (v.lRef < 0 || v.pos < 0 || v.pos + v.lRef > lSt1 || strncmp(ref, str1 + v.pos, v.lRef) != 0)
+        {
+            mexErrMsgTxt("variant ref allele must match seq1 at pos.\n.");
+        }
+
+        lVar = mxGetCell(VARS,iVar+2*nVar) ? (int)mxGetNumberOfElements(mxGetCell(VARS,iVar+2*nVar)) : 0;
+        alt = (char*)mxCalloc(lVar + 2,sizeof(char));
+        v.lAlt = GetAllele(mxGetCell(VARS,iVar+2*nVar), alt, lVar + 1);
+
+        if (v.lAlt < 0)
+        {
+            mexErrMsgTxt("variant alt allele must be a string.\n.");
+        }
+
+        altCode = (unsigned char*)mxCalloc(v.lAlt + 1,sizeof(unsigned char));
+        seqToInt(alt, altCode, v.lAlt);
+        v.alt = altCode;
+
+        delta = v.lAlt - v.lRef;
+        lShared = std::min(v.lRef, v.lAlt);
+
+
+        // greedy state just before the first window overlapping the
+        // edit, taken from the baseline hits
+
+        iFirst = std::max(0LL, v.pos - lSt2 + 1);
+
+        iBase = (long long)(std::lower_bound(base.begin(), base.end(), iFirst) - base.begin());
+        varNext = (iBase > 0) ? base[iBase-1] + lSt2 : 0;
+
+        varHits.clear();
+        varStrand.clear();
+        varScore.clear();
+
+
+        // edited sequence from iFirst on, until both selections are
+        // free at an unedited position
+
+        for (x = iFirst; x + lSt2 <= lSt1 + delta; x++)
+        {
+            if (x >= v.pos + v.lAlt && varNext <= x)
+            {
+                xs = x - delta;
+                i = (long long)(std::lower_bound(base.begin(), base.end(), xs) - base.begin());
+                baseNext = (i > 0) ? base[i-1] + lSt2 : 0;
+
+                if (baseNext <= xs) break;
+            }
+
+            if (x < varNext) continue;
+
+            score = 0.0;
+            scoreR = 0.0;
+
+            for (iCh = 0; iCh < lSt2; iCh++)
+            {
+                i = VarBase(&v, x + iCh) + iCh*4;
+
+                score += motif_profile[i];
+                scoreR += motif_profileR[i];
+            }
+
+            score = score/(double)lSt2;
+            scoreR = scoreR/(double)lSt2;
+
+            if (score >= pct_ident || scoreR >= pct_ident)
+            {
+                varHits.push_back(x);
+                varStrand.push_back(score >= scoreR ? 1.0 : -1.0);
+                varScore.push_back(score >= scoreR ? score : scoreR);
+                varNext = x + lSt2;
+            }
+        }
+
+
+        // rescanned stretch of seq1 ends where the selections met again
+
+        iResync = (x + lSt2 <= lSt1 + delta) ? x - delta : lSt1;
+
+
+        // compare with the baseline hits of the rescanned stretch,
+        // positions outside the edit (and inside it for the bases ref
+        // and alt share) are mapped to seq1
+
+        mapped.clear();
+
+        for (i = 0; i < (long long)varHits.size(); i++)
+        {
+            x = varHits[i];
+
+            if (x >= v.pos + lShared && x < v.pos + v.lAlt) xs = -1;
+            else if (x >= v.pos + v.lAlt) xs = x - delta;
+            else xs = x;
+
+            if (xs >= 0 && std::binary_search(base.begin(), base.end(), xs))
+            {
+                mapped.push_back(xs);
+                continue;
+            }
+
+            gained.push_back(iVar + 1);
+            gained.push_back(x + 1);
+            gained.push_back(varStrand[i]);
+            gained.push_back(varScore[i]);
+        }
+
+        for (i = iBase; i < nBase && base[i] < iResync; i++)
+        {
+            if (std::find(mapped.begin(), mapped.end(), base[i]) != mapped.end()) continue;
+
+            lost.push_back(iVar + 1);
+            lost.push_back(base[i] + 1);
+        }
+
+        mxFree(ref);
+        mxFree(alt);
+        mxFree(altCode);
+    }
+
+
+    // Row-per-hit outputs
+
+    GAINED = mxCreateDoubleMatrix(gained.size()/4, 4, mxREAL);
+    out = mxGetPr(GAINED);
+
+    for (i = 0; i < (long long)gained.size()/4; i++)
+    {
+        for (iCh = 0; iCh < 4; iCh++)
+        {
+            out[i + iCh*(gained.size()/4)] = gained[4*i+iCh];
+        }
+    }
+
+    if (nlhs > 1)
+    {
+        LOST = mxCreateDoubleMatrix(lost.size()/2, 2, mxREAL);
+        out = mxGetPr(LOST);
+
+        for (i = 0; i < (long long)lost.size()/2; i++)
+        {
+            out[i] = lost[2*i];
+            out[i + lost.size()/2] = lost[2*i+1];
+        }
+    }
+
+    mxFree(str1);
+    mxFree(sequence);
+    mxFree(motif_profile);
+    mxFree(motif_profileR);
+
+    return;
+}
+
+
+// base code at position x of the edited sequence
+
+int VarBase(const Variant *v, long long x)
+{
+    if (x < v->pos) return v->seq[x];
+    if (x < v->pos + v->lAlt) return v->alt[x - v->pos];
+
+    return v->seq[x - v->lAlt + v->lRef];
+}
+
+
+// allele string into buf, '' and '-' are empty. returns the length
+// or -1 if a is not a string
+
+int GetAllele(const mxArray *a, char *buf, int max)
+{
+    if (a == NULL || (!mxIsChar(a) && !mxIsEmpty(a)))
+    {
+        return -1;
+    }
+
+    buf[0] = 0;
+
+    if (mxIsChar(a) && mxGetNumberOfElements(a) > 0 && mxGetString(a, buf, max) != 0)
+    {
+        return -1;
+    }
+
+    if (strcmp(buf, "-") == 0) buf[0] = 0;
+
+    return (int)strlen(buf);
+}
+
+
+// void RevComp takes substr profile and returns reverse compliment
+// profile in substrR
+
+void RevComp(double *substr, double *substrR, mwSize smotif)
+{
+
+    mwSize i,j,k;
+
+    for (i = 0; i < smotif; i++)
+    {
+        j = i*4;
+        k = (smotif-i-1)*4;
+        substrR[k] = substr[j+3];
+        substrR[k+1] = substr[j+2];
+        substrR[k+2] = substr[j+1];
+        substrR[k+3] = substr[j];
+    }
+}
+
+
+void seqToInt(char *seqstr, unsigned char *seq, mwSize seqlen) {
+
+    mwSize i;
+
+    for (i = 0; i < seqlen; i++)
+    {
+
+        switch  (seqstr[i])
+        {
+            case 'A':
+                seq[i] = 0;
+                break;
+
+            case 'C':
+                seq[i] = 1;
+                break;
+
+            case 'G':
+                seq[i] = 2;
+                break;
+
+            case 'T':
+                seq[i] = 3;
+                break;
+        }
+
+    }
+
+}
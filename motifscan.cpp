@@ -0,0 +1,356 @@
+/*=================================================================
+ *  motifscan.cpp
+ *
+ *  nhits = motifscan(filename,motifs,pct_ident,outfile)
+ *  nhits = motifscan(filename,motifs,pct_ident,outfile,nthreads)
+ *  [nhits,stats] = motifscan(...)
+ *
+ *  streams the records of a FASTA file (.fa, .fa.gz or .fa.bgz) of any
+ *  size through a search for one or more motifs (a string or a cell
+ *  array of strings of A, C, G, T) and writes the hits to outfile, one
+ *  line per hit in file order:
+ *
+ *      name <tab> motif <tab> ind <tab> strand <tab> score
+ *
+ *  name is the record header up to the first white space and motif the
+ *  index into motifs. ind, strand and score are those motifind_revcomp
+ *  returns for the motif on the record: windows with >= pct_ident
+ *  percentage of bases in common with the motif or its reverse
+ *  compliment, overlapping words counted as 1. bases match in either
+ *  case, anything but A, C, G, T matches nothing.
+ *
+ *  reading, encoding, scanning (on nthreads threads, default: all
+ *  cores) and writing run as a pipeline (see seqpipe.h), so the disk
+ *  and the cores are busy at the same time. the optional stats output
+ *  is that of motifind (see callstats.h), the times are the busy time
+ *  of each stage summed over its threads.
+ *
+ *  compile with: mex motifscan.cpp -lz
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include "mex.h"
+#include "seqpipe.h"
+
+
+#define FNAME    prhs[0]
+#define MOTIFS   prhs[1]
+#define PID      prhs[2]
+#define OUTF     prhs[3]
+#define NTH      prhs[4]
+#define OUT      plhs[0]
+#define STATS    plhs[1]
+#define WORD     32     /* bases per packed word */
+
+
+// a motif and its reverse compliment packed 2 bits per base in chunks
+// of WORD bases from the end of the motif, the last base of a chunk
+// lowest, as the windows are rolled. low flags the bases of a chunk
+
+struct ScanMotif
+{
+    int     len, maxMis, nChunk;
+    std::vector<unsigned long long> pFwd, pRev, low;
+};
+
+struct ScanJob
+{
+    std::vector<ScanMotif> mot;
+    int     maxLen;
+    double  pct_ident;
+};
+
+
+int CountMis(unsigned long long x);
+void ScanBatch(SeqBatch *b, void *ctx, CallStats *st);
+
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *fname, *str;
+    const mxArray *cell;
+    int     nthreads, nMot, iMot, iCh, k, t, c;
+    std::vector<unsigned char> fwd;
+    ScanJob job;
+    ScanMotif *mo;
+    FILE    *fid;
+    std::string err;
+    CallStats st;
+
+
+    // Check for correct number of arguments
+
+    if (nrhs < 4 || nrhs > 5)
+    {
+        mexErrMsgTxt("Usage: [nhits,stats] = motifscan(filename,motifs,pct_ident,outfile,nthreads)\n");
+    }
+    if (nlhs > 2)
+    {
+        mexErrMsgTxt("Usage: [nhits,stats] = motifscan(filename,motifs,pct_ident,outfile,nthreads)\n");
+    }
+
+    // Check to be sure inputs are correct
+
+    if (!(mxIsChar(FNAME)) || !(mxIsChar(OUTF)))
+    {
+        mexErrMsgTxt("filename and outfile must be of type string.\n.");
+    }
+    if (!mxIsChar(MOTIFS) && !mxIsCell(MOTIFS))
+    {
+        mexErrMsgTxt("motifs must be a string or a cell array of strings.\n.");
+    }
+    if (mxGetM(PID) != 1 || mxGetN(PID) != 1)
+    {
+        mexErrMsgTxt("pct_ident must be a scalar.\n.");
+    }
+
+    job.pct_ident = mxGetScalar(PID);
+
+    if ((job.pct_ident <= 0) || (job.pct_ident > 1))
+    {
+        mexErrMsgTxt("pct_ident must be a scalar 0< pct_ident <=1 .\n.");
+    }
+
+    nthreads = (int)std::thread::hardware_concurrency();
+
+    if (nrhs == 5)
+    {
+        if (mxGetNumberOfElements(NTH) != 1)
+        {
+            mexErrMsgTxt("nthreads must be a scalar.\n.");
+        }
+        nthreads = (int)mxGetScalar(NTH);
+    }
+
+    if (nthreads < 1) nthreads = 1;
+
+
+    // Motifs as codes (A C G T = 0..3 as the pipeline encoder), their
+    // reverse compliments and the most mismatches a hit can have
+
+    nMot = mxIsCell(MOTIFS) ? (int)mxGetNumberOfElements(MOTIFS) : 1;
+
+    if (nMot < 1)
+    {
+        mexErrMsgTxt("motifs must not be empty.\n.");
+    }
+
+    job.mot.resize(nMot);
+    job.maxLen = 0;
+
+    for (iMot = 0; iMot < nMot; iMot++)
+    {
+        cell = mxIsCell(MOTIFS) ? mxGetCell(MOTIFS, iMot) : MOTIFS;
+
+        if (cell == NULL || !mxIsChar(cell) || mxGetNumberOfElements(cell) < 1)
+        {
+            mexErrMsgTxt("motifs must be a string or a cell array of strings.\n.");
+        }
+
+        mo = &job.mot[iMot];
+        str = mxArrayToString(cell);
+        mo->len = (int)strlen(str);
+        fwd.resize(mo->len);
+
+        for (iCh = 0; iCh < mo->len; iCh++)
+        {
+            switch (str[iCh])
+            {
+                case 'A': case 'a': c = 0; break;
+                case 'C': case 'c': c = 1; break;
+                case 'G': case 'g': c = 2; break;
+                case 'T': case 't': c = 3; break;
+                default:
+                mxFree(str);
+                mexErrMsgTxt("motifs must contain only A, C, G and T.\n.");
+                c = 0;
+            }
+            fwd[iCh] = (unsigned char)c;
+        }
+        mxFree(str);
+
+        // base t of chunk k is motif base len-1-WORD*k-t, which the
+        // reverse compliment has complemented at WORD*k+t
+
+        mo->nChunk = (mo->len + WORD - 1)/WORD;
+        mo->pFwd.assign(mo->nChunk, 0);
+        mo->pRev.assign(mo->nChunk, 0);
+        mo->low.assign(mo->nChunk, 0);
+
+        for (k = 0; k < mo->nChunk; k++)
+        {
+            for (t = 0; t < WORD && WORD*k + t < mo->len; t++)
+            {
+                mo->pFwd[k] |= (unsigned long long)fwd[mo->len - 1 - WORD*k - t] << (2*t);
+                mo->pRev[k] |= (unsigned long long)(3 - fwd[WORD*k + t]) << (2*t);
+                mo->low[k] |= 1ULL << (2*t);
+            }
+        }
+
+        mo->maxMis = mo->len;
+
+        while (mo->maxMis >= 0 && (double)(mo->len - mo->maxMis)/(double)mo->len < job.pct_ident)
+        {
+            mo->maxMis--;
+        }
+
+        if (mo->len > job.maxLen) job.maxLen = mo->len;
+    }
+
+
+    // Run the pipeline
+
+    fname = mxArrayToString(OUTF);
+    fid = fopen(fname, "wb");
+    mxFree(fname);
+
+    if (fid == NULL)
+    {
+        mexErrMsgTxt("could not open outfile for writing.\n.");
+    }
+
+    StatsInit(&st);
+
+    fname = mxArrayToString(FNAME);
+    err = SeqPipeRun(fname, fid, nthreads, ScanBatch, &job, &st);
+    mxFree(fname);
+
+    if (fclose(fid) != 0 && err.empty())
+    {
+        err = "error writing output file";
+    }
+
+    if (!err.empty())
+    {
+        mexErrMsgTxt((err + ".\n").c_str());
+    }
+
+    OUT = mxCreateDoubleScalar((double)st.hits);
+
+    if (nlhs > 1)
+    {
+        STATS = StatsToArray(&st);
+    }
+
+    return;
+}
+
+
+
+// number of bases differing, x holding one flag bit per base
+
+int CountMis(unsigned long long x)
+{
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+
+// ScanBatch finds the hits of every motif in the records of a batch,
+// greedy left to right on each record as motifind_revcomp. the last
+// WORD bases are rolled into a word of codes and a word of N flags,
+// the words of the last maxLen positions are kept in a ring, so a
+// window is compared a chunk of WORD bases at a time
+
+void ScanBatch(SeqBatch *b, void *ctx, CallStats *st)
+{
+    ScanJob *job = (ScanJob*)ctx;
+    const unsigned char *seq;
+    const PipeRecord *r;
+    ScanMotif *mo;
+    std::vector<size_t> iNext(job->mot.size());
+    std::vector<unsigned long long> ring, nRing;
+    unsigned long long w, nw, d;
+    size_t iRec, iPos, iFirst, nameLen, rMask, j;
+    int    iMot, nMot, k, nMis, nMisR, n;
+    double score, scoreR;
+    char   line[96];
+
+    nMot = (int)job->mot.size();
+
+    for (rMask = 1; rMask < (size_t)job->maxLen; rMask *= 2);
+
+    ring.resize(rMask);
+    nRing.resize(rMask);
+    rMask--;
+
+    for (iRec = 0; iRec < b->rec.size(); iRec++)
+    {
+        r = &b->rec[iRec];
+        seq = (const unsigned char*)b->seq.data() + r->seq;
+
+        for (nameLen = 0; nameLen < r->headLen; nameLen++)
+        {
+            if (b->head[r->head + nameLen] == ' ' || b->head[r->head + nameLen] == '\t') break;
+        }
+
+        for (iMot = 0; iMot < nMot; iMot++) iNext[iMot] = 0;
+
+        w = nw = 0;
+
+        for (iPos = 0; iPos < r->seqLen; iPos++)
+        {
+            w = (w << 2) | (seq[iPos] & 3);
+            nw = (nw << 2) | (seq[iPos] >> 2);
+            ring[iPos & rMask] = w;
+            nRing[iPos & rMask] = nw;
+
+            for (iMot = 0; iMot < nMot; iMot++)
+            {
+                mo = &job->mot[iMot];
+
+                if (iPos + 1 < (size_t)mo->len) continue;
+
+                iFirst = iPos + 1 - mo->len;
+
+                if (iFirst < iNext[iMot]) continue;
+
+                st->windows++;
+
+                d = w ^ mo->pFwd[0];
+                nMis = CountMis((d | (d >> 1) | nw) & mo->low[0]);
+                d = w ^ mo->pRev[0];
+                nMisR = CountMis((d | (d >> 1) | nw) & mo->low[0]);
+
+                for (k = 1; k < mo->nChunk && (nMis <= mo->maxMis || nMisR <= mo->maxMis); k++)
+                {
+                    j = (iPos - WORD*k) & rMask;
+                    d = ring[j] ^ mo->pFwd[k];
+                    nMis += CountMis((d | (d >> 1) | nRing[j]) & mo->low[k]);
+                    d = ring[j] ^ mo->pRev[k];
+                    nMisR += CountMis((d | (d >> 1) | nRing[j]) & mo->low[k]);
+                }
+
+                if (nMis > mo->maxMis && nMisR > mo->maxMis)
+                {
+                    if (k < mo->nChunk) st->abandoned++;
+                    continue;
+                }
+
+                score = (double)(mo->len - nMis)/(double)mo->len;
+                scoreR = (double)(mo->len - nMisR)/(double)mo->len;
+
+                if (score < job->pct_ident && scoreR < job->pct_ident) continue;
+
+                st->hitsRaw++;
+                st->hits++;
+                iNext[iMot] = iPos + 1;
+
+                b->out.append(b->head, r->head, nameLen);
+
+                n = snprintf(line, sizeof(line), "\t%d\t%llu\t%d\t%.6g\n", iMot + 1,
+                             (unsigned long long)iFirst + 1, score >= scoreR ? 1 : -1,
+                             score >= scoreR ? score : scoreR);
+                b->out.append(line, n);
+            }
+        }
+    }
+}
@@ -0,0 +1,458 @@
+/*=================================================================
+ *  motifspacing.cpp
+ *
+ *  [H,nhits] = motifspacing(seq1,motifs,pct_ident,maxdist)
+ *  [H,nhits] = motifspacing({twobitfile,name[,region]},motifs,pct_ident,maxdist)
+ *
+ *  spacing and orientation histograms of all pairs of motif hits in
+ *  seq1, counted in a single scan without keeping the hit lists
+ *
+ *  motifs is a cell array of motifs, each either a string (scored as
+ *  in motifind_revcomp) or a 4 x N profile in the order A C G T
+ *  (scored as in motifind_revcomp_profile). pct_ident is a scalar or
+ *  one value per motif. hits of each motif exclude overlaps with the
+ *  earlier hits of the same motif, so they are the hits the
+ *  motifind_revcomp tools return for it.
+ *
+ *  H is nmot x nmot x 4 x (maxdist+1): H(a,b,s,d+1) counts the pairs of
+ *  a hit of motif a and a later hit of motif b starting d bases after
+ *  it (0 <= d <= maxdist), with strand combination s = 1 (+,+),
+ *  2 (+,-), 3 (-,+) or 4 (-,-). hits of two motifs at the same position
+ *  are counted once, with the lower motif index as a. nhits gives the
+ *  number of hits of each motif.
+ *
+ *  hits of every motif within maxdist of the scan position are kept in
+ *  a ring buffer per motif, at most maxdist/motif_length+1 of them
+ *  since hits of one motif do not overlap.
+ *
+ *  seq1 can be read from a UCSC .2bit file: sequence name, or its
+ *  bases region = [first last], of twobitfile (see twobit.h).
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h> /* strlen */
+#include "mex.h"
+#include "twobit.h"
+
+
+#define MOTIFS  prhs[1]
+#define PID     prhs[2]
+#define MAXD    prhs[3]
+#define OUT     plhs[0]
+#define NHITS   plhs[1]
+#define MAX      30
+
+
+// one motif: its scoring tables, greedy state and recent hits
+
+typedef struct
+{
+    int     len, isProf, maxMis;
+    mwSize  iNext;
+    char    *str, *strR;
+    double  *prof, *profR, *sufMax, *sufMaxR, need, pct;
+    int     cap, head, n, *ringStrand;
+    mwSize  *ringPos;
+    double  nHits;
+} Motif;
+
+void RevComp(char *substr, char *substrR);
+void RevCompProfile(double *substr, double *substrR, mwSize smotif);
+void seqToInt(char *seqstr, unsigned char *seq, mwSize seqlen);
+double MaxOf4(const double *col);
+int ScoreWindow(Motif *mo, const char *str1, const unsigned char *sequence, mwSize iPos, int *strand);
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *str1;
+    int     iMot, nMot, jMot, i, j, k, s, maxdist, strand;
+    mwSize  lSt1, iPos, p;
+    unsigned char *sequence;
+    double  *H, *pct, score;
+    mwSize  dims[4];
+    Motif   *mot, *mo;
+    const mxArray *cell;
+
+
+    // Check for correct number of arguments
+
+    if (nrhs != 4 || nlhs > 2)
+    {
+        mexErrMsgTxt("Usage: [H,nhits] = motifspacing(seq1,motifs,pct_ident,maxdist)\n");
+    }
+
+
+    // Check to be sure inputs are correct
+
+    if (!(mxIsChar(prhs[0])) && !(mxIsCell(prhs[0])))
+    {
+        mexErrMsgTxt("seq1 must be a string or {twobitfile,name[,region]}.\n.");
+    }
+
+    if (!mxIsCell(MOTIFS) || mxGetNumberOfElements(MOTIFS) < 1)
+    {
+        mexErrMsgTxt("motifs must be a cell array of strings or 4 x N profiles.\n.");
+    }
+
+    nMot = (int)mxGetNumberOfElements(MOTIFS);
+
+    if (!mxIsDouble(PID) || (mxGetNumberOfElements(PID) != 1 && (int)mxGetNumberOfElements(PID) != nMot))
+    {
+        mexErrMsgTxt("pct_ident must be a scalar or have one value per motif.\n.");
+    }
+
+    pct = mxGetPr(PID);
+
+    for (i = 0; i < (int)mxGetNumberOfElements(PID); i++)
+    {
+        if ((pct[i] <= 0) || (pct[i] > 1))
+        {
+            mexErrMsgTxt("pct_ident must be 0< pct_ident <=1 .\n.");
+        }
+    }
+
+    if (mxGetNumberOfElements(MAXD) != 1 || mxGetScalar(MAXD) < 0 || mxGetScalar(MAXD) > 1e6)
+    {
+        mexErrMsgTxt("maxdist must be a scalar 0 <= maxdist <= 1e6.\n.");
+    }
+
+    maxdist = (int)mxGetScalar(MAXD);
+
+    str1 = mxIsCell(prhs[0]) ? TwoBitCellToString(prhs[0]) : mxArrayToString(prhs[0]);
+    lSt1 = strlen(str1);
+
+
+    // convert main nuc. sequence into an integer array for the profiles
+
+    sequence = (unsigned char*)mxCalloc(lSt1 > 0 ? lSt1 : 1,sizeof(unsigned char));
+
+    seqToInt(str1,sequence,lSt1);
+
+
+    // Set up the motifs
+
+    mot = (Motif*)mxCalloc(nMot,sizeof(Motif));
+
+    for (iMot = 0; iMot < nMot; iMot++)
+    {
+        mo = mot + iMot;
+        cell = mxGetCell(MOTIFS,iMot);
+        mo->pct = pct[mxGetNumberOfElements(PID) == 1 ? 0 : iMot];
+
+        if (cell != NULL && mxIsChar(cell))
+        {
+            mo->str = mxArrayToString(cell);
+            mo->strR = mxArrayToString(cell);
+            mo->len = (int)strlen(mo->str);
+
+            RevComp(mo->str,mo->strR);
+
+            // Most mismatches a passing window can have
+
+            mo->maxMis = mo->len;
+
+            while (mo->maxMis >= 0 && (double)(mo->len - mo->maxMis)/(double)mo->len < mo->pct)
+            {
+                mo->maxMis--;
+            }
+        }
+        else if (cell != NULL && mxIsDouble(cell) && mxGetM(cell) == 4)
+        {
+            mo->isProf = 1;
+            mo->len = (int)mxGetN(cell);
+
+            if (mo->len > MAX)
+            {
+                mexErrMsgTxt("motif_length must be <= 30.\n.");
+            }
+
+
+            // normalized copy of the profile
+
+            mo->prof = (double*)mxCalloc(4*mo->len,sizeof(double));
+            mo->profR = (double*)mxCalloc(4*mo->len,sizeof(double));
+
+            memcpy(mo->prof, mxGetPr(cell), 4*mo->len*sizeof(double));
+
+            for (k = 0; k < mo->len; k++)
+            {
+                i = k*4;
+                score = mo->prof[i] + mo->prof[i+1] + mo->prof[i+2] + mo->prof[i+3];
+
+                mo->prof[i] /= score;
+                mo->prof[i+1] /= score;
+                mo->prof[i+2] /= score;
+                mo->prof[i+3] /= score;
+            }
+
+            RevCompProfile(mo->prof,mo->profR,mo->len);
+
+
+            // Best score still reachable from each motif position on
+
+            mo->sufMax = (double*)mxCalloc(mo->len+1,sizeof(double));
+            mo->sufMaxR = (double*)mxCalloc(mo->len+1,sizeof(double));
+
+            for (k = mo->len-1; k >= 0; k--)
+            {
+                mo->sufMax[k] = mo->sufMax[k+1] + MaxOf4(mo->prof + 4*k);
+                mo->sufMaxR[k] = mo->sufMaxR[k+1] + MaxOf4(mo->profR + 4*k);
+            }
+
+            mo->need = mo->pct*(double)mo->len - 1e-9*(double)mo->len;
+        }
+        else
+        {
+            mexErrMsgTxt("motifs must be a cell array of strings or 4 x N profiles.\n.");
+        }
+
+        if (mo->len < 1 || (mwSize)mo->len > lSt1)
+        {
+            mexErrMsgTxt("each motif must be non-empty and no longer than seq1.\n.");
+        }
+
+
+        // hits of this motif within maxdist of a later hit
+
+        mo->cap = maxdist/mo->len + 1;
+        mo->ringPos = (mwSize*)mxCalloc(mo->cap,sizeof(mwSize));
+        mo->ringStrand = (int*)mxCalloc(mo->cap,sizeof(int));
+    }
+
+    dims[0] = nMot;
+    dims[1] = nMot;
+    dims[2] = 4;
+    dims[3] = maxdist + 1;
+
+    OUT = mxCreateNumericArray(4, dims, mxDOUBLE_CLASS, mxREAL);
+    H = mxGetPr(OUT);
+
+
+    // Scan once, all motifs at each position in motif order
+
+    for (iPos = 0; iPos < lSt1; iPos++)
+    {
+        for (jMot = 0; jMot < nMot; jMot++)
+        {
+            mo = mot + jMot;
+
+            if (iPos < mo->iNext || iPos + mo->len > lSt1) continue;
+
+            if (!ScoreWindow(mo, str1, sequence, iPos, &strand)) continue;
+
+            mo->nHits += 1.0;
+            mo->iNext = iPos + mo->len; /* avoid overlaps */
+
+
+            // pair with the recent hits of every motif, newest first
+
+            for (iMot = 0; iMot < nMot; iMot++)
+            {
+                for (k = 0; k < mot[iMot].n; k++)
+                {
+                    j = mot[iMot].head - 1 - k;
+                    if (j < 0) j += mot[iMot].cap;
+
+                    p = iPos - mot[iMot].ringPos[j];
+                    if (p > (mwSize)maxdist) break;
+
+                    s = 2*(mot[iMot].ringStrand[j] < 0) + (strand < 0);
+                    H[iMot + nMot*(jMot + nMot*(s + 4*p))] += 1.0;
+                }
+            }
+
+
+            // the oldest hit, dropped once the ring is full, is more than
+            // maxdist before any later hit
+
+            mo->ringPos[mo->head] = iPos;
+            mo->ringStrand[mo->head] = strand;
+            mo->head = (mo->head + 1 == mo->cap) ? 0 : mo->head + 1;
+            if (mo->n < mo->cap) mo->n++;
+        }
+    }
+
+    if (nlhs > 1)
+    {
+        NHITS = mxCreateDoubleMatrix(nMot, 1, mxREAL);
+
+        for (iMot = 0; iMot < nMot; iMot++)
+        {
+            mxGetPr(NHITS)[iMot] = mot[iMot].nHits;
+        }
+    }
+
+    for (iMot = 0; iMot < nMot; iMot++)
+    {
+        mo = mot + iMot;
+
+        if (mo->isProf)
+        {
+            mxFree(mo->prof);
+            mxFree(mo->profR);
+            mxFree(mo->sufMax);
+            mxFree(mo->sufMaxR);
+        }
+        else
+        {
+            mxFree(mo->str);
+            mxFree(mo->strR);
+        }
+
+        mxFree(mo->ringPos);
+        mxFree(mo->ringStrand);
+    }
+
+    mxFree(mot);
+    mxFree(sequence);
+    mxFree(str1);
+
+    return;
+}
+
+
+// ScoreWindow scores the window of seq1 at iPos against both strands of
+// a motif, returns 1 if either passes and the better strand (1 / -1)
+
+int ScoreWindow(Motif *mo, const char *str1, const unsigned char *sequence, mwSize iPos, int *strand)
+{
+    double score, scoreR;
+    int    iCh, nMis, nMisR;
+
+    score = 0.0;
+    scoreR = 0.0;
+
+    if (mo->isProf)
+    {
+        for (iCh = 0; iCh < mo->len; iCh++)
+        {
+            score += mo->prof[4*iCh + sequence[iCh+iPos]];
+            scoreR += mo->profR[4*iCh + sequence[iCh+iPos]];
+
+            if (iCh+1 < mo->len && score + mo->sufMax[iCh+1] < mo->need && scoreR + mo->sufMaxR[iCh+1] < mo->need) return 0;
+        }
+    }
+    else
+    {
+        nMis = 0;
+        nMisR = 0;
+
+        for (iCh = 0; iCh < mo->len; iCh++)
+        {
+            if (str1[iCh+iPos] == mo->str[iCh]) score += 1.0;
+            else nMis++;
+
+            if (str1[iCh+iPos] == mo->strR[iCh]) scoreR += 1.0;
+            else nMisR++;
+
+            if (nMis > mo->maxMis && nMisR > mo->maxMis) return 0;
+        }
+    }
+
+    score = score/(double)mo->len;
+    scoreR = scoreR/(double)mo->len;
+
+    if (score < mo->pct && scoreR < mo->pct) return 0;
+
+    *strand = (score >= scoreR) ? 1 : -1;
+
+    return 1;
+}
+
+
+void RevComp(char *substr, char *substrR)
+{
+    int i, smotif;
+    smotif = strlen(substr);
+
+    for (i = 0; i < smotif; i++)
+    {
+        switch  (substr[smotif-i-1])
+        {
+            case 'A':
+            substrR[i] = 'T';
+            break;
+
+            case 'T':
+            substrR[i] = 'A';
+            break;
+
+            case 'C':
+            substrR[i] = 'G';
+            break;
+
+            case 'G':
+            substrR[i] = 'C';
+            break;
+        }
+    }
+
+}
+
+
+// void RevCompProfile takes substr profile and returns reverse compliment
+// profile in substrR
+
+void RevCompProfile(double *substr, double *substrR, mwSize smotif)
+{
+
+    mwSize i,j,k;
+
+    for (i = 0; i < smotif; i++)
+    {
+        j = i*4;
+        k = (smotif-i-1)*4;
+        substrR[k] = substr[j+3];
+        substrR[k+1] = substr[j+2];
+        substrR[k+2] = substr[j+1];
+        substrR[k+3] = substr[j];
+    }
+}
+
+
+void seqToInt(char *seqstr, unsigned char *seq, mwSize seqlen) {
+
+    mwSize i;
+
+    for (i = 0; i < seqlen; i++)
+    {
+
+        switch  (seqstr[i])
+        {
+            case 'A':
+                seq[i] = 0;
+                break;
+
+            case 'C':
+                seq[i] = 1;
+                break;
+
+            case 'G':
+                seq[i] = 2;
+                break;
+
+            case 'T':
+                seq[i] = 3;
+                break;
+        }
+
+    }
+
+}
+
+
+// largest of the four base frequencies of a profile column
+
+double MaxOf4(const double *col)
+{
+    double m = col[0];
+
+    if (col[1] > m) m = col[1];
+    if (col[2] > m) m = col[2];
+    if (col[3] > m) m = col[3];
+
+    return m;
+}
@@ -0,0 +1,162 @@
+/*=================================================================
+ *  phaseprof.h
+ *
+ *  per-phase hardware counters for the scanning tools
+ *
+ *  compiled in only with PHASE_PROF defined, e.g.
+ *      mex -DPHASE_PROF motifind.cpp
+ *  otherwise the PROF_ macros expand to nothing and cost nothing.
+ *
+ *  a call is split into phases: encode (reading and converting the
+ *  inputs), scan (scoring windows), resolve (overlap removal, where a
+ *  tool does it apart from the scan; most remove overlaps inline and
+ *  report them under scan) and output (building the MATLAB outputs).
+ *  PROF_PHASE ends the running phase and starts the next, PROF_REPORT
+ *  ends the last one and prints a table with cycles, instructions,
+ *  L1D read misses, LLC misses and branch misses per phase, plus IPC
+ *  and cycles per base.
+ *
+ *  counters come from perf_event_open (Linux, user space only) and
+ *  are opened once per MATLAB session. counters the machine or the
+ *  perf_event_paranoid setting does not allow are shown as n/a.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef PHASEPROF_H
+#define PHASEPROF_H
+
+enum { PP_ENCODE, PP_SCAN, PP_RESOLVE, PP_OUTPUT, PP_NPHASE, PP_NONE = -1 };
+
+#ifdef PHASE_PROF
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "mex.h"
+
+#define PP_NEVENT   5
+
+typedef struct
+{
+    int       phase;
+    long long start[PP_NEVENT];
+    long long total[PP_NPHASE][PP_NEVENT];
+} PhaseProf;
+
+static int pp_fd[PP_NEVENT];
+static int pp_open = 0;
+
+
+static int PhaseProfOpen(unsigned int type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+static void PhaseProfRead(long long *val)
+{
+    int i;
+
+    for (i = 0; i < PP_NEVENT; i++)
+    {
+        val[i] = 0;
+        if (pp_fd[i] >= 0 && read(pp_fd[i], &val[i], sizeof(long long)) != sizeof(long long)) val[i] = 0;
+    }
+}
+
+
+static void PhaseProfStart(PhaseProf *p)
+{
+    if (!pp_open)
+    {
+        pp_fd[0] = PhaseProfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        pp_fd[1] = PhaseProfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        pp_fd[2] = PhaseProfOpen(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                 | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                 | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        pp_fd[3] = PhaseProfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        pp_fd[4] = PhaseProfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        pp_open = 1;
+    }
+
+    memset(p, 0, sizeof(*p));
+    p->phase = PP_NONE;
+}
+
+
+static void PhaseProfSwitch(PhaseProf *p, int phase)
+{
+    long long now[PP_NEVENT];
+    int i;
+
+    PhaseProfRead(now);
+
+    if (p->phase != PP_NONE)
+    {
+        for (i = 0; i < PP_NEVENT; i++) p->total[p->phase][i] += now[i] - p->start[i];
+    }
+
+    memcpy(p->start, now, sizeof(now));
+    p->phase = phase;
+}
+
+
+static void PhaseProfReport(PhaseProf *p, const char *tool, double nbases)
+{
+    const char *names[PP_NPHASE] = {"encode", "scan", "resolve", "output"};
+    int i, j;
+
+    PhaseProfSwitch(p, PP_NONE);
+
+    mexPrintf("%s: %.0f bases\n", tool, nbases);
+    mexPrintf("%-8s %14s %14s %6s %12s %12s %12s %10s\n", "phase", "cycles",
+              "instructions", "IPC", "L1D miss", "LLC miss", "br miss", "cyc/base");
+
+    for (i = 0; i < PP_NPHASE; i++)
+    {
+        mexPrintf("%-8s", names[i]);
+
+        for (j = 0; j < PP_NEVENT; j++)
+        {
+            if (pp_fd[j] < 0) mexPrintf(" %*s", j < 2 ? 14 : 12, "n/a");
+            else mexPrintf(" %*lld", j < 2 ? 14 : 12, p->total[i][j]);
+
+            if (j == 1)
+            {
+                if (pp_fd[0] < 0 || pp_fd[1] < 0 || p->total[i][0] == 0) mexPrintf(" %6s", "-");
+                else mexPrintf(" %6.2f", (double)p->total[i][1]/(double)p->total[i][0]);
+            }
+        }
+
+        if (pp_fd[0] < 0 || nbases <= 0) mexPrintf(" %10s\n", "-");
+        else mexPrintf(" %10.2f\n", (double)p->total[i][0]/nbases);
+    }
+}
+
+
+#define PROF_DECLARE            PhaseProf prof_;
+#define PROF_START()            PhaseProfStart(&prof_)
+#define PROF_PHASE(ph)          PhaseProfSwitch(&prof_, ph)
+#define PROF_REPORT(tool, n)    PhaseProfReport(&prof_, tool, (double)(n))
+
+#else
+
+#define PROF_DECLARE
+#define PROF_START()
+#define PROF_PHASE(ph)
+#define PROF_REPORT(tool, n)
+
+#endif
+
+#endif
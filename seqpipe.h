@@ -0,0 +1,539 @@
+/*=================================================================
+ *  seqpipe.h
+ *
+ *  streaming pipeline for scanning FASTA files too large to load:
+ *
+ *      reader -> encoder -> scanners (nthreads) -> writer
+ *
+ *  the reader thread decodes the file (fastagz.h) and parses it into
+ *  batches of whole records of about PIPE_BATCH bases, the encoder
+ *  thread converts the bases of each batch in place to codes
+ *  (A C G T = 0..3, anything else 4, either case), a pool of scanner
+ *  threads run the tool's scan function on whole batches, which
+ *  formats its hits into the batch, and the calling thread writes the
+ *  batches to the output file in input order.
+ *
+ *  stages are connected by bounded lock-free queues of batch pointers
+ *  (PipeQueue). the batches come from a fixed pool of PIPE_DEPTH per
+ *  scanner and are recycled once written; their buffers keep their
+ *  capacity, so once the first batches have grown nothing is
+ *  allocated, and a slow stage stalls the ones before it instead of
+ *  memory growing. records are never split, a single long record is
+ *  scanned by one thread.
+ *
+ *  No mex API calls are made from the pipeline threads; errors are
+ *  returned as strings and raised by the caller.
+ *
+ *  link with -lz
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef SEQPIPE_H
+#define SEQPIPE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "fastagz.h"
+#include "callstats.h"
+
+
+#define PIPE_BATCH   (1 << 20)  /* bases per batch */
+#define PIPE_DEPTH   3          /* batches in flight per scanner */
+
+
+// one record of a batch, offsets into the batch buffers
+
+struct PipeRecord
+{
+    size_t head, headLen;
+    size_t seq, seqLen;
+};
+
+struct SeqBatch
+{
+    long long id;                   /* position in the input */
+    std::vector<PipeRecord> rec;
+    std::string head;               /* headers, back to back */
+    std::string seq;                /* bases, then codes, back to back */
+    std::string out;                /* text written for the batch */
+};
+
+
+// scans the encoded records of a batch, appends its output to b->out
+// and counts its work in st. called from several threads at once
+
+typedef void (*PipeScanFn)(SeqBatch *b, void *ctx, CallStats *st);
+
+
+
+// bounded multi-producer multi-consumer queue: every cell carries a
+// sequence number telling producers and consumers whose turn it is,
+// so push and pop are a compare-and-swap on the head or tail only
+
+struct PipeCell
+{
+    std::atomic<size_t> turn;
+    SeqBatch *b;
+};
+
+struct PipeQueue
+{
+    PipeCell *cell;
+    size_t   mask;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) std::atomic<size_t> head;
+};
+
+
+static inline void PipeQueueInit(PipeQueue *q, size_t n)
+{
+    size_t size, i;
+
+    for (size = 2; size < n; size *= 2);
+
+    q->cell = new PipeCell[size];
+    q->mask = size - 1;
+
+    for (i = 0; i < size; i++) q->cell[i].turn.store(i, std::memory_order_relaxed);
+
+    q->tail.store(0, std::memory_order_relaxed);
+    q->head.store(0, std::memory_order_relaxed);
+}
+
+
+static inline bool PipeTryPush(PipeQueue *q, SeqBatch *b)
+{
+    PipeCell *c;
+    size_t pos, turn;
+
+    pos = q->tail.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        c = &q->cell[pos & q->mask];
+        turn = c->turn.load(std::memory_order_acquire);
+
+        if (turn == pos)
+        {
+            if (q->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        else if (turn < pos)
+        {
+            return false;   /* full */
+        }
+        else
+        {
+            pos = q->tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    c->b = b;
+    c->turn.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+
+static inline bool PipeTryPop(PipeQueue *q, SeqBatch **b)
+{
+    PipeCell *c;
+    size_t pos, turn;
+
+    pos = q->head.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        c = &q->cell[pos & q->mask];
+        turn = c->turn.load(std::memory_order_acquire);
+
+        if (turn == pos + 1)
+        {
+            if (q->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        else if (turn < pos + 1)
+        {
+            return false;   /* empty */
+        }
+        else
+        {
+            pos = q->head.load(std::memory_order_relaxed);
+        }
+    }
+
+    *b = c->b;
+    c->turn.store(pos + q->mask + 1, std::memory_order_release);
+
+    return true;
+}
+
+
+// waiting stages spin briefly, then sleep so an idle stage does not
+// take a core from a busy one
+
+static inline void PipeBackoff(int *spins)
+{
+    if (++*spins < 64) std::this_thread::yield();
+    else std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+static inline void PipePush(PipeQueue *q, SeqBatch *b)
+{
+    int spins = 0;
+
+    while (!PipeTryPush(q, b)) PipeBackoff(&spins);
+}
+
+static inline SeqBatch *PipePop(PipeQueue *q)
+{
+    SeqBatch *b;
+    int spins = 0;
+
+    while (!PipeTryPop(q, &b)) PipeBackoff(&spins);
+
+    return b;
+}
+
+
+
+// the pipeline. a NULL batch marks the end of the stream in a queue
+
+struct SeqPipe
+{
+    const char *fname;
+    int        nScan, nInflate;
+    PipeScanFn scan;
+    void       *ctx;
+
+    std::vector<SeqBatch*> pool;
+    PipeQueue  freeQ, encQ, scanQ, writeQ;
+
+    SeqBatch   *cur;                /* batch the reader is filling */
+    long long  nextId;
+    bool       inHeader;
+
+    std::atomic<int>  nDone;        /* scanners finished */
+    std::atomic<bool> stop;         /* error, drain without work */
+    std::string err;
+
+    CallStats  stRead, stEnc;
+    std::vector<CallStats> stScan;
+};
+
+
+// hand the filled batch to the encoder and take an empty one
+
+static inline void PipeShip(SeqPipe *p)
+{
+    p->cur->id = p->nextId++;
+    PipePush(&p->encQ, p->cur);
+    p->cur = PipePop(&p->freeQ);
+}
+
+
+// FASTA parser of the reader, as FastaParserFeed but filling batches
+
+static inline bool PipeFeed(const char *data, size_t len, void *ctx)
+{
+    SeqPipe *p = (SeqPipe*)ctx;
+    SeqBatch *b;
+    PipeRecord r;
+    size_t i, start;
+    double t0;
+
+    if (p->stop) return false;
+
+    t0 = StatsClock();
+    i = 0;
+
+    while (i < len)
+    {
+        b = p->cur;
+
+        if (p->inHeader)
+        {
+            start = i;
+            while (i < len && data[i] != '\n') i++;
+
+            b->head.append(data + start, i - start);
+            b->rec.back().headLen += i - start;
+
+            if (i < len)
+            {
+                // strip trailing CR of DOS line endings
+
+                if (b->rec.back().headLen > 0 && b->head[b->head.size()-1] == '\r')
+                {
+                    b->head.erase(b->head.size()-1);
+                    b->rec.back().headLen--;
+                }
+                p->inHeader = false;
+                i++;
+            }
+            continue;
+        }
+
+        if (data[i] == '>')
+        {
+            if (b->seq.size() >= PIPE_BATCH)
+            {
+                p->stRead.time[PP_ENCODE] += StatsClock() - t0;
+                PipeShip(p);
+                t0 = StatsClock();
+                b = p->cur;
+            }
+
+            r.head = b->head.size();
+            r.headLen = 0;
+            r.seq = b->seq.size();
+            r.seqLen = 0;
+            b->rec.push_back(r);
+
+            p->inHeader = true;
+            i++;
+            continue;
+        }
+
+        // sequence text, copy runs between whitespace in one go
+
+        start = i;
+        while (i < len && data[i] != '>' && data[i] != '\n' && data[i] != '\r'
+               && data[i] != ' ' && data[i] != '\t')
+        {
+            i++;
+        }
+
+        if (i > start)
+        {
+            if (b->rec.empty())
+            {
+                r.head = r.headLen = 0;
+                r.seq = r.seqLen = 0;
+                b->rec.push_back(r);
+            }
+            b->seq.append(data + start, i - start);
+            b->rec.back().seqLen += i - start;
+            p->stRead.bytes += i - start;
+        }
+
+        if (i < len && data[i] != '>') i++;
+    }
+
+    p->stRead.time[PP_ENCODE] += StatsClock() - t0;
+
+    return !p->stop;
+}
+
+
+static inline void PipeReader(SeqPipe *p)
+{
+    int bgzf;
+
+    p->cur = PipePop(&p->freeQ);
+
+    bgzf = IsBgzf(p->fname);
+
+    if (bgzf < 0) p->err = std::string("cannot open ") + p->fname;
+    else if (bgzf == 1) p->err = BgzfReadParallel(p->fname, PipeFeed, p, p->nInflate);
+    else p->err = GzReadStream(p->fname, PipeFeed, p);
+
+    if (!p->err.empty()) p->stop = true;
+
+    if (!p->cur->rec.empty()) PipeShip(p);
+
+    PipePush(&p->encQ, NULL);
+}
+
+
+static inline void PipeEncoder(SeqPipe *p)
+{
+    unsigned char code[256];
+    SeqBatch *b;
+    size_t i, n;
+    char *s;
+    double t0;
+    int c;
+
+    for (c = 0; c < 256; c++) code[c] = 4;
+
+    code['A'] = code['a'] = 0;
+    code['C'] = code['c'] = 1;
+    code['G'] = code['g'] = 2;
+    code['T'] = code['t'] = 3;
+
+    while ((b = PipePop(&p->encQ)) != NULL)
+    {
+        t0 = StatsClock();
+
+        s = &b->seq[0];
+        n = b->seq.size();
+
+        for (i = 0; i < n; i++) s[i] = (char)code[(unsigned char)s[i]];
+
+        p->stEnc.time[PP_ENCODE] += StatsClock() - t0;
+
+        PipePush(&p->scanQ, b);
+    }
+
+    for (c = 0; c < p->nScan; c++) PipePush(&p->scanQ, NULL);
+}
+
+
+static inline void PipeScanner(SeqPipe *p, int iScan)
+{
+    SeqBatch *b;
+    double t0;
+
+    while ((b = PipePop(&p->scanQ)) != NULL)
+    {
+        t0 = StatsClock();
+
+        if (!p->stop) p->scan(b, p->ctx, &p->stScan[iScan]);
+
+        p->stScan[iScan].time[PP_SCAN] += StatsClock() - t0;
+
+        PipePush(&p->writeQ, b);
+    }
+
+    // the last scanner to finish ends the writer's stream, every
+    // batch has been pushed by then
+
+    if (++p->nDone == p->nScan) PipePush(&p->writeQ, NULL);
+}
+
+
+
+// scan the FASTA file fname on nthreads scanner threads, writing the
+// output of the batches to out in input order. returns an error
+// message or an empty string on success. st gets the work counts and
+// the busy time of each stage summed over its threads (reader and
+// encoder in time_encode, scanners in time_scan, writer in time_output)
+
+static inline std::string SeqPipeRun(const char *fname, FILE *out, int nthreads,
+                                     PipeScanFn scan, void *ctx, CallStats *st)
+{
+    SeqPipe p;
+    SeqBatch *b;
+    std::vector<SeqBatch*> pending;
+    std::vector<std::thread> workers;
+    std::string werr;
+    size_t nBatch, i;
+    long long next;
+    double t0;
+
+    if (nthreads < 1) nthreads = 1;
+
+    p.fname = fname;
+    p.nScan = nthreads;
+    p.nInflate = nthreads;
+    p.scan = scan;
+    p.ctx = ctx;
+    p.nextId = 0;
+    p.inHeader = false;
+    p.nDone = 0;
+    p.stop = false;
+
+    StatsInit(&p.stRead);
+    StatsInit(&p.stEnc);
+    p.stScan.resize(nthreads);
+    for (i = 0; i < (size_t)nthreads; i++) StatsInit(&p.stScan[i]);
+
+    // every batch fits in any queue, so pushes never wait: the pool
+    // alone bounds the batches in flight
+
+    nBatch = PIPE_DEPTH*nthreads + 2;
+
+    PipeQueueInit(&p.freeQ, nBatch + nthreads + 1);
+    PipeQueueInit(&p.encQ, nBatch + nthreads + 1);
+    PipeQueueInit(&p.scanQ, nBatch + nthreads + 1);
+    PipeQueueInit(&p.writeQ, nBatch + nthreads + 1);
+
+    for (i = 0; i < nBatch; i++)
+    {
+        p.pool.push_back(new SeqBatch());
+        PipePush(&p.freeQ, p.pool[i]);
+    }
+
+    workers.push_back(std::thread(PipeReader, &p));
+    workers.push_back(std::thread(PipeEncoder, &p));
+
+    for (i = 0; i < (size_t)nthreads; i++)
+    {
+        workers.push_back(std::thread(PipeScanner, &p, (int)i));
+    }
+
+
+    // writer: batches arrive in any order and are written in input
+    // order. at most nBatch are in flight, so their ids modulo nBatch
+    // are distinct
+
+    pending.assign(nBatch, NULL);
+    next = 0;
+
+    while ((b = PipePop(&p.writeQ)) != NULL)
+    {
+        pending[b->id % nBatch] = b;
+
+        while ((b = pending[next % nBatch]) != NULL && b->id == next)
+        {
+            pending[next % nBatch] = NULL;
+
+            t0 = StatsClock();
+
+            if (!p.stop && !b->out.empty() && fwrite(b->out.data(), 1, b->out.size(), out) != b->out.size())
+            {
+                werr = "error writing output file";
+                p.stop = true;
+            }
+
+            st->time[PP_OUTPUT] += StatsClock() - t0;
+
+            b->rec.clear();
+            b->head.clear();
+            b->seq.clear();
+            b->out.clear();
+            PipePush(&p.freeQ, b);
+            next++;
+        }
+    }
+
+    for (i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+
+    for (i = 0; i < nBatch; i++)
+    {
+        delete p.pool[i];
+    }
+
+    delete [] p.freeQ.cell;
+    delete [] p.encQ.cell;
+    delete [] p.scanQ.cell;
+    delete [] p.writeQ.cell;
+
+
+    // work counts and stage times
+
+    st->bytes += p.stRead.bytes;
+    st->time[PP_ENCODE] += p.stRead.time[PP_ENCODE] + p.stEnc.time[PP_ENCODE];
+
+    for (i = 0; i < (size_t)nthreads; i++)
+    {
+        st->windows += p.stScan[i].windows;
+        st->abandoned += p.stScan[i].abandoned;
+        st->hitsRaw += p.stScan[i].hitsRaw;
+        st->hits += p.stScan[i].hits;
+        st->time[PP_SCAN] += p.stScan[i].time[PP_SCAN];
+    }
+
+    return p.err.empty() ? werr : p.err;
+}
+
+
+#endif
@@ -0,0 +1,136 @@
+/*=================================================================
+ *  shardio.h
+ *
+ *  binary partial result files written by the sharded modes of
+ *  motifcount and the motifind tools and read by shardmerge
+ *
+ *  a part file is a ShardHeader followed by nrec records
+ *
+ *  SHARD_HITS   (motifind*): nrec 1-based window positions (long long)
+ *               of every window in the region passing pct_ident,
+ *               before overlap removal. windows at the end of the
+ *               region extend into the next one (the halo), so the
+ *               greedy non-overlap pass can be replayed exactly
+ *               across shard boundaries by the merge.
+ *
+ *  SHARD_SCORED (motifind_revcomp, motifind_revcomp_profile): as
+ *               SHARD_HITS, each record a ShardHit with the strand and
+ *               score of the window, so the merge can return them too.
+ *
+ *  SHARD_COUNTS (motifcount): nrec count table entries, each an int
+ *               motif index and variant count followed by nvar
+ *               ShardVariant records.
+ *
+ *               the non-overlap rule makes a motif's count in a region
+ *               depend on where its last counted occurrence in the
+ *               previous region ends (at most motif_size-1 windows
+ *               into this one, the halo). every motif occurring in the
+ *               halo therefore stores one variant per possible first
+ *               counted occurrence; the merge picks the variant with
+ *               the smallest start not before the carried position.
+ *               motifs without halo occurrences have a single variant
+ *               starting at the end of the halo.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef SHARDIO_H
+#define SHARDIO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "cinline.h"
+
+#define SHARD_MAGIC   "MSH1"
+#define SHARD_HITS    1
+#define SHARD_COUNTS  2
+#define SHARD_SCORED  3
+
+
+typedef struct
+{
+    char      magic[4];
+    int       type;     /* SHARD_HITS, SHARD_SCORED or SHARD_COUNTS */
+    long long width;    /* motif length / motif_size */
+    long long first;    /* first window of the region (1-based) */
+    long long last;     /* last window of the region (1-based) */
+    long long total;    /* number of windows in the whole sequence */
+    long long nrec;     /* number of records following the header */
+} ShardHeader;
+
+
+/* a passing window of a SHARD_SCORED part: 1-based position, strand
+   (1 / -1) and score of the better strand */
+
+typedef struct
+{
+    long long pos;
+    double    strand;
+    double    score;
+} ShardHit;
+
+
+/* one greedy chain of a motif within a region. occurrences before
+   start (0-based) are ignored, count is the number of occurrences
+   counted and next the position the last one blocks up to (0 if
+   nothing was counted) */
+
+typedef struct
+{
+    long long start;
+    long long count;
+    long long next;
+} ShardVariant;
+
+
+/* open a part file for writing and write its header, nrec is
+   patched in by ShardClose */
+
+static inline FILE *ShardOpen(const char *fname, int type, long long width,
+                              long long first, long long last, long long total)
+{
+    ShardHeader hdr;
+    FILE *fid;
+
+    fid = fopen(fname, "wb");
+    if (fid == NULL) return NULL;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SHARD_MAGIC, 4);
+    hdr.type  = type;
+    hdr.width = width;
+    hdr.first = first;
+    hdr.last  = last;
+    hdr.total = total;
+
+    fwrite(&hdr, sizeof(hdr), 1, fid);
+
+    return fid;
+}
+
+
+static inline int ShardClose(FILE *fid, long long nrec)
+{
+    int ok;
+
+    ok = (fseek(fid, (long)offsetof(ShardHeader, nrec), SEEK_SET) == 0);
+    ok = ok && (fwrite(&nrec, sizeof(nrec), 1, fid) == 1);
+    ok = (fclose(fid) == 0) && ok;
+
+    return ok;
+}
+
+
+/* read and check a part file header, returns 0 on failure */
+
+static inline int ShardReadHeader(FILE *fid, ShardHeader *hdr)
+{
+    if (fread(hdr, sizeof(*hdr), 1, fid) != 1) return 0;
+
+    return memcmp(hdr->magic, SHARD_MAGIC, 4) == 0
+        && (hdr->type == SHARD_HITS || hdr->type == SHARD_SCORED || hdr->type == SHARD_COUNTS);
+}
+
+
+#endif
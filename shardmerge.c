@@ -0,0 +1,411 @@
+/*=================================================================
+ *  shardmerge.c
+ *
+ *  out = shardmerge(partfiles)
+ *  [ind,strand,score] = shardmerge(partfiles)
+ *
+ *  merges the partial results written by the sharded modes of
+ *  motifcount and motifind / motifind_revcomp / motifind_revcomp_profile
+ *  into the output of a single call over the whole sequence
+ *
+ *  partfiles is a cell array with the part file of every region, in
+ *  any order. the regions must cover the sequence without gaps.
+ *
+ *  hit lists are concatenated in region order and overlapping windows
+ *  removed with the same greedy rule as the scanners, giving the same
+ *  int64 row of indicies as the scanners. parts of motifind_revcomp and
+ *  motifind_revcomp_profile also hold the strand and score of each
+ *  window, returned as the optional second and third outputs. count tables
+ *  are summed, carrying the last counted occurrence of each motif
+ *  into the next region to pick the matching halo variant.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "mex.h"
+#include "matrix.h"
+#include "shardio.h"
+#include "hitbuf.h"
+
+#define PARTS    prhs[0]
+#define OUT      plhs[0]
+#define STRAND   plhs[1]
+#define SCORE    plhs[2]
+#define MAX      13
+
+const char bases[4] = "ATCG";
+
+void GetMotif(const int iMot, const mwSize smotif, char *substr);
+void GetIndex(const char *substr, int *iMot);
+void RevComp(char *substr);
+FILE *OpenPart(const mxArray *parts, const int iPart, ShardHeader *hdr);
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+	char    *substr;
+	int     nPart, iPart, jPart, *order, iMot1, nVar, iVar, best, iPos, iCh;
+	long long hit, next, iRec, *carry, *moCount;
+	HitBuf  hits;
+	mwSize  *dims, ndim, smotif, nmotif, cmotif;
+	ShardHeader *hdr, h0;
+	ShardHit rec;
+	ShardVariant var[2*MAX];
+	FILE    *fid;
+
+	ndim = 2;
+
+	/* Check for correct number of arguments */
+
+	if (nrhs != 1)
+	{
+		mexErrMsgTxt("Usage: [out,strand,score] = shardmerge(partfiles)\n");
+	}
+	if (nlhs > 3)
+	{
+		mexErrMsgTxt("Usage: [out,strand,score] = shardmerge(partfiles)\n");
+	}
+
+	if (!mxIsCell(PARTS) || mxGetNumberOfElements(PARTS) == 0)
+	{
+		mexErrMsgTxt("partfiles must be a non-empty cell array of file names.\n.");
+	}
+
+	nPart = (int)mxGetNumberOfElements(PARTS);
+
+	/* Read headers and sort the parts by region */
+
+	hdr = (ShardHeader*)mxCalloc(nPart,sizeof(ShardHeader));
+	order = (int*)mxCalloc(nPart,sizeof(int));
+
+	for (iPart = 0; iPart < nPart; iPart++)
+	{
+		fid = OpenPart(PARTS,iPart,&hdr[iPart]);
+		fclose(fid);
+
+		for (jPart = iPart; jPart > 0 && hdr[order[jPart-1]].first > hdr[iPart].first; jPart--)
+		{
+			order[jPart] = order[jPart-1];
+		}
+		order[jPart] = iPart;
+	}
+
+	h0 = hdr[order[0]];
+
+	for (iPart = 0; iPart < nPart; iPart++)
+	{
+		if (hdr[iPart].type != h0.type || hdr[iPart].width != h0.width || hdr[iPart].total != h0.total)
+		{
+			mexErrMsgTxt("part files come from different runs.\n.");
+		}
+		if ((iPart == 0 && hdr[order[0]].first != 1) ||
+			(iPart > 0 && hdr[order[iPart]].first != hdr[order[iPart-1]].last + 1))
+		{
+			mexErrMsgTxt("regions of the part files must cover the sequence without gaps or overlaps.\n.");
+		}
+	}
+
+	if (hdr[order[nPart-1]].last != h0.total)
+	{
+		mexErrMsgTxt("regions of the part files must cover the sequence without gaps or overlaps.\n.");
+	}
+
+	if (nlhs > 1 && h0.type != SHARD_SCORED)
+	{
+		mexErrMsgTxt("strand and score are only kept by motifind_revcomp and motifind_revcomp_profile parts.\n.");
+	}
+
+	/* Hit lists: replay the greedy overlap removal over all regions */
+
+	if (h0.type == SHARD_HITS || h0.type == SHARD_SCORED)
+	{
+		HitInit(&hits, h0.type == SHARD_SCORED);
+		next = 0;
+
+		for (iPart = 0; iPart < nPart; iPart++)
+		{
+			fid = OpenPart(PARTS,order[iPart],&h0);
+
+			for (iRec = 0; iRec < h0.nrec; iRec++)
+			{
+				if (h0.type == SHARD_SCORED)
+				{
+					if (fread(&rec,sizeof(rec),1,fid) != 1)
+					{
+						fclose(fid);
+						mexErrMsgTxt("truncated part file.\n.");
+					}
+					hit = rec.pos;
+				}
+				else if (fread(&hit,sizeof(hit),1,fid) != 1)
+				{
+					fclose(fid);
+					mexErrMsgTxt("truncated part file.\n.");
+				}
+
+				if (hit < next) continue;
+
+				if (h0.type == SHARD_SCORED)
+				{
+					HitAdd(&hits, hit, rec.strand, rec.score);
+				}
+				else
+				{
+					HitAdd(&hits, hit, 0.0, 0.0);
+				}
+				next = hit + h0.width;
+			}
+
+			fclose(fid);
+		}
+
+		OUT = HitPositions(&hits);
+
+		if (nlhs > 1)
+		{
+			STRAND = HitStrands(&hits);
+		}
+
+		if (nlhs > 2)
+		{
+			SCORE = HitScores(&hits);
+		}
+
+		HitFree(&hits);
+		mxFree(hdr);
+		mxFree(order);
+
+		return;
+	}
+
+	/* Count tables */
+
+	smotif = (mwSize)h0.width;
+
+	if (smotif < 1 || smotif > MAX)
+	{
+		mexErrMsgTxt("invalid motif_size in part file.\n.");
+	}
+
+	nmotif = (mwSize)1 << (2*smotif);
+
+	substr = (char*)mxCalloc(smotif+1,sizeof(char));
+	moCount = (long long*)mxCalloc(nmotif,sizeof(long long));
+	carry = (long long*)mxCalloc(nmotif,sizeof(long long));
+
+	/* same reverse compliment bookkeeping as motifcount */
+
+	for (iPos = 0; iPos < nmotif; iPos++)
+	{
+		GetMotif(iPos,smotif,substr);
+		RevComp(substr);
+		GetIndex(substr,&iMot1);
+		if (iMot1 < iPos)
+		{
+			moCount[iPos] = -1;
+		}
+	}
+
+	for (iPart = 0; iPart < nPart; iPart++)
+	{
+		fid = OpenPart(PARTS,order[iPart],&h0);
+
+		for (iRec = 0; iRec < h0.nrec; iRec++)
+		{
+			if (fread(&iMot1,sizeof(int),1,fid) != 1 || fread(&nVar,sizeof(int),1,fid) != 1 ||
+				iMot1 < 0 || iMot1 >= (int)nmotif || nVar < 1 || nVar > 2*MAX ||
+				fread(var,sizeof(ShardVariant),nVar,fid) != (size_t)nVar)
+			{
+				fclose(fid);
+				mexErrMsgTxt("truncated or corrupt part file.\n.");
+			}
+
+			/* chain whose first counted occurrence is not blocked by
+			   the carried one */
+
+			best = -1;
+			for (iVar = 0; iVar < nVar; iVar++)
+			{
+				if (var[iVar].start >= carry[iMot1] && (best < 0 || var[iVar].start < var[best].start))
+				{
+					best = iVar;
+				}
+			}
+
+			if (best < 0)
+			{
+				fclose(fid);
+				mexErrMsgTxt("corrupt part file.\n.");
+			}
+
+			moCount[iMot1] += var[best].count;
+			if (var[best].next > 0) carry[iMot1] = var[best].next;
+		}
+
+		fclose(fid);
+	}
+
+	/* create matlab cell array with motif counts */
+
+	cmotif = 0;
+
+	for (iPos = 0; iPos < nmotif; iPos++)
+	{
+		if (moCount[iPos] != -1) cmotif++;
+	}
+
+	dims = (mwSize*)mxCalloc(2,sizeof(mwSize));
+	dims[0] = cmotif;
+	dims[1] = 2;
+
+	OUT = mxCreateCellArray(ndim, dims);
+
+	iCh = 0;
+	for (iPos = 0; iPos < nmotif; iPos++)
+	{
+		if (moCount[iPos] != -1)
+		{
+			GetMotif(iPos,smotif,substr);
+			mxSetCell(OUT,iCh,mxCreateString(substr));
+			mxSetCell(OUT,iCh+cmotif,mxCreateDoubleScalar((double)moCount[iPos]));
+			iCh++;
+		}
+	}
+
+	mxFree(substr);
+	mxFree(moCount);
+	mxFree(carry);
+	mxFree(dims);
+	mxFree(hdr);
+	mxFree(order);
+
+	return;
+}
+
+/* open part file iPart of the cell array and read its header */
+
+FILE *OpenPart(const mxArray *parts, const int iPart, ShardHeader *hdr)
+{
+	char *fname;
+	FILE *fid;
+	const mxArray *cell;
+
+	cell = mxGetCell(parts,iPart);
+
+	if (cell == NULL || !mxIsChar(cell))
+	{
+		mexErrMsgTxt("partfiles must be a cell array of file names.\n.");
+	}
+
+	fname = mxArrayToString(cell);
+	fid = fopen(fname,"rb");
+	mxFree(fname);
+
+	if (fid == NULL)
+	{
+		mexErrMsgTxt("could not open part file.\n.");
+	}
+
+	if (!ShardReadHeader(fid,hdr))
+	{
+		fclose(fid);
+		mexErrMsgTxt("not a part file.\n.");
+	}
+
+	return fid;
+}
+
+void GetMotif(const int iMot, const mwSize smotif, char *substr)
+{
+    int i;
+
+    for (i = 0; i < smotif; i++)
+    {
+        substr[i] = bases[(iMot >> (2*(smotif-i-1))) & 3];
+    }
+
+}
+
+void GetIndex(const char *substr, int *iMot)
+{
+    int i, num;
+    i = 0;
+    *iMot = 0;
+
+    while (substr[i] != 0)
+    {
+
+        switch (substr[i])
+        {
+
+        case 'A':
+        num = 0;
+        break;
+
+        case 'T':
+        num = 1;
+        break;
+
+        case 'C':
+        num = 2;
+        break;
+
+        case 'G':
+        num = 3;
+        break;
+
+        default:
+        num = 0;
+        break;
+        }
+
+        *iMot = (*iMot << 2) | num;
+
+        i++;
+    }
+
+}
+
+void RevComp(char *substr)
+{
+    char temp[MAX];
+    int i, smotif;
+    smotif = strlen(substr);
+
+    for (i = 0; i < smotif; i++)
+    {
+        temp[i] = substr[i];
+    }
+
+    i = 0;
+
+    while (smotif > 0)
+    {
+        smotif--;
+
+        switch  (temp[smotif])
+        {
+            case 'A':
+            substr[i] = 'T';
+            break;
+
+            case 'T':
+            substr[i] = 'A';
+            break;
+
+            case 'C':
+            substr[i] = 'G';
+            break;
+
+            case 'G':
+            substr[i] = 'C';
+            break;
+        }
+
+        i++;
+    }
+
+}
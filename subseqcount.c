@@ -2,12 +2,27 @@
  *  subseqcount.c
  *
  *  ind = subseqcount(seq1,seq2,motif_size,pct_ident)
+ *  ind = subseqcount(seq1,seq2,motif_size,pct_ident,index)
+ *  [ind,stats] = subseqcount(...)
+ *  ind = subseqcount({twobitfile,name[,region]},seq2,...)
  *
  *  returns cell array containing subseq and # of repeats found in seq1 for each subsequence 
  *  of length (motif_size) in 
  *  seq2 having >= pct_ident 
  *  percentage of characters in common
  * 
+ *  with a minimizer index of seq1 (mmindex) subsequences are looked up
+ *  in the index instead of scanned for, whenever pct_ident is high
+ *  enough for the seeding to find every hit (see mmindex.h)
+ *
+ *  the optional stats output holds the work done and the time spent
+ *  in each phase (see callstats.h), summed over all subsequences. the
+ *  scan is the same as without it; for hits_raw the windows overlapping
+ *  a hit, which the scan skips, are scored apart, outside windows,
+ *  abandoned and the phase times.
+ *  
+ *  seq1 can be read from a UCSC .2bit file instead: the sequence name,
+ *  or its bases region = [first last], of twobitfile (see twobit.h).
  *  
  *  Brian Kolterman 8/2012
  *=================================================================*/
@@ -17,43 +32,66 @@
 #include <string.h> 
 #include "mex.h"
 #include "matrix.h"
+#include "mmindex.h"
+#include "twobit.h"
+#include "phaseprof.h"
+#include "callstats.h"
 
 #define MS      prhs[2]
 #define PID     prhs[3]
+#define INDEX   prhs[4]
 #define OUT     plhs[0]
+#define STATS   plhs[1]
+
+mwSize OverlapHits(const char *str1, const char *substr, mwSize smotif, mwSize iFrom, mwSize iTo, double pct_ident);
 
 void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 {
 	char    *str1, *str2, *substr;
-	int     lSt1, lSt2, iPos, iCh, iLast, iSub;
+	mwSize  lSt1, lSt2, iPos, iCh, iLast, iSub;
 	double  score, pct_ident, nHits;
 	mwSize *dims, ndim, smotif, nmotif;
+	mwSize *cand, nCand, iCand, iNext;
+	MmIndex mmi;
+	const char *err;
+	int useIndex, rawHits, nMis, maxMis;
+	CallStats st;
+	PROF_DECLARE
 
 	ndim = 2;
 
 	/* Check for correct number of arguments */     
 
-	if (nrhs != 4) 
+	if (nrhs != 4 && nrhs != 5) 
 	{
-		mexErrMsgTxt("Usage: ind = subseqcount(seq1,seq2,motif_size,pct_ident)\n");
+		mexErrMsgTxt("Usage: [ind,stats] = subseqcount(seq1,seq2,motif_size,pct_ident[,index])\n");
 	} 
-	if (nlhs > 1)
+	if (nlhs > 2)
 	{
-		mexErrMsgTxt("Usage: ind = subseqcount(seq1,seq2,motif_size,pct_ident)\n");
+		mexErrMsgTxt("Usage: [ind,stats] = subseqcount(seq1,seq2,motif_size,pct_ident[,index])\n");
 	}
 
+	StatsInit(&st);
+	StatsPhase(&st, PP_ENCODE);
+	PROF_START();
+	PROF_PHASE(PP_ENCODE);
+
 	/* Check to be sure inputs are correct */
 
-	if (!(mxIsChar(prhs[0])) && !(mxIsChar(prhs[1])))
+	if (!(mxIsChar(prhs[0])) && !(mxIsCell(prhs[0])))
 	{
-		mexErrMsgTxt("seq1 and seq2 must be of type string.\n.");
+		mexErrMsgTxt("seq1 must be a string or {twobitfile,name[,region]}.\n.");
+	}
+	if (!(mxIsChar(prhs[1])))
+	{
+		mexErrMsgTxt("seq2 must be of type string.\n.");
 	}
 
-	str1=mxArrayToString(prhs[0]);
+	str1 = mxIsCell(prhs[0]) ? TwoBitCellToString(prhs[0]) : mxArrayToString(prhs[0]);
 	str2=mxArrayToString(prhs[1]);
 
-	lSt1 = (int)strlen(str1);
-	lSt2 = (int)strlen(str2);
+	lSt1 = strlen(str1);
+	lSt2 = strlen(str2);
 
 	if (lSt1 < lSt2)
 	{
@@ -84,9 +122,42 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 
 	nmotif = lSt2 - smotif + 1;
 
+	st.bytes = lSt1 + lSt2;
+
+	/* most mismatches a passing window can have, scoring of a window
+	   is abandoned once it has more */
+
+	maxMis = (int)smotif;
+
+	while (maxMis >= 0 && (double)((int)smotif - maxMis)/(double)smotif < pct_ident)
+	{
+		maxMis--;
+	}
+
+	rawHits = (nlhs > 1);
+
+	useIndex = 0;
+	memset(&mmi, 0, sizeof(mmi));
+
+	if (nrhs == 5)
+	{
+		err = MmIndexFromArray(INDEX, &mmi);
+
+		if (err != NULL)
+		{
+			mexErrMsgTxt(err);
+		}
+		if (mmi.n != lSt1)
+		{
+			mexErrMsgTxt("index must be built from seq1.\n.");
+		}
+
+		useIndex = 1;
+	}
+
 	/* Set up temproary storage and output cell array */
 
-	substr = (char*)mxCalloc(smotif,sizeof(char*));
+	substr = (char*)mxCalloc(smotif+1,sizeof(char));
 
 	iLast = (lSt1 - smotif + 1);
 
@@ -99,6 +170,9 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 	/*fout = (mxArray*)mxCreateCellMatrix(100, 2);*/
 
 
+	StatsPhase(&st, PP_SCAN);
+	PROF_PHASE(PP_SCAN);
+
 	/* Start iterating through subsequences */
 
 	for (iSub = 0; iSub < nmotif; iSub++)
@@ -112,13 +186,73 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
 		nHits = 0.0;
 
 
-        
+	/* Seeded: verify the candidates from the index only */
+
+        if (useIndex && MmUsable(&mmi, substr, smotif, pct_ident))
+        {
+            nCand = MmCandidates(&mmi, substr, smotif, iLast, &cand);
+            iNext = 0;
+
+            for (iCand = 0; iCand < nCand; iCand++)
+            {
+                if (cand[iCand] < iNext) continue;
+
+                score = 0.0;
+                nMis = 0;
+                st.windows++;
+
+                for (iCh = 0; iCh < smotif; iCh++)
+                {
+                    if (str1[iCh+cand[iCand]] == substr[iCh])
+                    {
+                        score += 1.0;
+                    }
+                    else if (++nMis > maxMis)
+                    {
+                        break;
+                    }
+                }
+
+                if (nMis > maxMis)
+                {
+                    if (iCh+1 < smotif) st.abandoned++;
+                    continue;
+                }
+
+                if (score/(double)smotif >= pct_ident)
+                {
+                    st.hitsRaw++;
+
+                    nHits += 1.0;
+                    st.hits++;
+                    iNext = cand[iCand] + smotif; /* avoid overlaps */
+
+                    if (rawHits) /* the skipped overlapping windows */
+                    {
+                        StatsPhase(&st, PP_NONE);
+                        PROF_PHASE(PP_NONE);
+                        st.hitsRaw += OverlapHits(str1, substr, smotif, cand[iCand]+1, iNext < iLast ? iNext : iLast, pct_ident);
+                        StatsPhase(&st, PP_SCAN);
+                        PROF_PHASE(PP_SCAN);
+                    }
+                }
+            }
+
+            mxFree(cand);
+
+            mxSetCell(OUT,iSub,mxCreateString(substr));
+            mxSetCell(OUT,iSub+nmotif,mxCreateDoubleScalar(nHits));
+            continue;
+        }
+
 
 	/* Do the comparison */
         
         for (iPos = 0; iPos < iLast; iPos++) 
         {
             score = 0.0;
+            nMis = 0;
+            st.windows++;
             
              for (iCh = 0; iCh < smotif; iCh++) 
              {
@@ -129,13 +263,36 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
                     score += 1.0;
                 
                 }
+                else if (++nMis > maxMis)
+                {
+                    break;
+                }
+            }
+            
+            if (nMis > maxMis)
+            {
+                if (iCh+1 < smotif) st.abandoned++;
+                continue;
             }
             
             score = score/(double)smotif;
             
             if (score >= pct_ident) 
             {
+                st.hitsRaw++;
+                
                 nHits += 1.0;
+                st.hits++;
+                
+                if (rawHits) /* the skipped overlapping windows */
+                {
+                    StatsPhase(&st, PP_NONE);
+                    PROF_PHASE(PP_NONE);
+                    st.hitsRaw += OverlapHits(str1, substr, smotif, iPos+1, iPos+smotif < iLast ? iPos+smotif : iLast, pct_ident);
+                    StatsPhase(&st, PP_SCAN);
+                    PROF_PHASE(PP_SCAN);
+                }
+                
                 iPos += (smotif - 1); /* avoid overlaps */
             }
         }
@@ -149,9 +306,45 @@ void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
     
     
     
+    StatsPhase(&st, PP_OUTPUT);
+    PROF_PHASE(PP_OUTPUT);
+    
+    if (nlhs > 1)
+    {
+        STATS = StatsToArray(&st);
+    }
+    
     mxFree(str1);
     mxFree(str2);
     mxFree(substr);
     
+    PROF_REPORT("subseqcount", (double)lSt1*nmotif);
+    
     return;
 }
+
+
+/* number of windows iFrom..iTo-1 passing pct_ident, the windows after
+   a hit that the scan skips, scored only for the hits_raw stat */
+
+mwSize OverlapHits(const char *str1, const char *substr, mwSize smotif, mwSize iFrom, mwSize iTo, double pct_ident)
+{
+	mwSize iPos, iCh, n;
+	double score;
+
+	n = 0;
+
+	for (iPos = iFrom; iPos < iTo; iPos++)
+	{
+		score = 0.0;
+
+		for (iCh = 0; iCh < smotif; iCh++)
+		{
+			if (str1[iCh+iPos] == substr[iCh]) score += 1.0;
+		}
+
+		if (score/(double)smotif >= pct_ident) n++;
+	}
+
+	return n;
+}
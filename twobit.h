@@ -0,0 +1,487 @@
+/*=================================================================
+ *  twobit.h
+ *
+ *  memory mapped reader for UCSC .2bit sequence files, used by
+ *  twobitread and as a sequence source of the scanning tools
+ *
+ *  a .2bit file holds for every sequence its length, the runs of N
+ *  and of soft-masked (lower case) bases, and the bases packed 4 per
+ *  byte (T C A G = 0..3, first base in the high bits; N runs are
+ *  stored as T). the file is mapped once and sequences are read in
+ *  place, so any sequence or region is available without decoding
+ *  the rest of the file. files written on machines of either byte
+ *  order and version 1 files (64-bit offsets) are read.
+ *
+ *  TwoBitCode walks a sequence base by base and returns the packed
+ *  code, or TB_N inside an N run, for scanners that encode bases
+ *  themselves (motifcount_window); TwoBitDecode writes a region as
+ *  text. TwoBitCellToString turns a {twobitfile,name[,region]} seq
+ *  argument into the string the text scanners (motifcount,
+ *  subseqcount, motifind, motifind_revcomp, motifind_revcomp_profile,
+ *  motifind_variants, motifspacing) would get from mxArrayToString,
+ *  decoded straight from the mapped file.
+ *
+ *  the file is mapped with mmap, or CreateFileMapping on Windows.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+#ifndef TWOBIT_H
+#define TWOBIT_H
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "mex.h"
+#include "cinline.h"
+
+#define TB_SIG      0x1A412743u
+#define TB_N        4
+
+
+typedef struct
+{
+    const unsigned char *map;   /* the mapped file */
+    size_t size;
+    int swap;                   /* file byte order differs from ours */
+    unsigned int nSeq;
+    const char **name;          /* sequence names (not terminated) */
+    unsigned char *lName;
+    unsigned long long *offset; /* offset of each sequence record */
+} TwoBitFile;
+
+
+typedef struct
+{
+    const TwoBitFile *tb;
+    unsigned int len;           /* number of bases */
+    unsigned int nN, nMask;     /* number of N and mask runs */
+    const unsigned char *nStart, *nSize, *mStart, *mSize;
+    const unsigned char *dna;   /* packed bases */
+} TwoBitSeq;
+
+
+/* walks a sequence in increasing positions, keeping track of the
+   next N run */
+
+typedef struct
+{
+    const TwoBitSeq *s;
+    unsigned int iN, nEnd;
+} TwoBitCursor;
+
+
+static inline unsigned int TwoBitU32(const TwoBitFile *tb, const unsigned char *p)
+{
+    unsigned int v;
+
+    memcpy(&v, p, 4);
+
+    if (tb->swap)
+    {
+        v = (v >> 24) | ((v >> 8) & 0xff00u) | ((v << 8) & 0xff0000u) | (v << 24);
+    }
+
+    return v;
+}
+
+
+static inline unsigned long long TwoBitU64(const TwoBitFile *tb, const unsigned char *p)
+{
+    unsigned long long lo, hi;
+
+    lo = TwoBitU32(tb, p + (tb->swap ? 4 : 0));
+    hi = TwoBitU32(tb, p + (tb->swap ? 0 : 4));
+
+    return (hi << 32) | lo;
+}
+
+
+static inline void TwoBitClose(TwoBitFile *tb)
+{
+#ifdef _WIN32
+    if (tb->map != NULL) UnmapViewOfFile((LPCVOID)tb->map);
+#else
+    if (tb->map != NULL) munmap((void*)tb->map, tb->size);
+#endif
+    free((void*)tb->name);
+    free(tb->lName);
+    free(tb->offset);
+    memset(tb, 0, sizeof(*tb));
+}
+
+
+/* maps fname and reads its sequence index, returns NULL or an error */
+
+static inline const char *TwoBitOpen(const char *fname, TwoBitFile *tb)
+{
+    unsigned int sig, version, i;
+    size_t p;
+    void *map;
+#ifdef _WIN32
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+#else
+    struct stat sb;
+    int fd;
+#endif
+
+    memset(tb, 0, sizeof(*tb));
+
+#ifdef _WIN32
+    file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return "could not open 2bit file.\n.";
+    }
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < 16)
+    {
+        CloseHandle(file);
+        return "not a 2bit file.\n.";
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    map = (mapping != NULL) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+    if (mapping != NULL) CloseHandle(mapping);
+    CloseHandle(file);
+
+    if (map == NULL)
+    {
+        return "could not map 2bit file.\n.";
+    }
+
+    tb->map = (const unsigned char*)map;
+    tb->size = (size_t)size.QuadPart;
+#else
+    fd = open(fname, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return "could not open 2bit file.\n.";
+    }
+    if (fstat(fd, &sb) != 0 || sb.st_size < 16)
+    {
+        close(fd);
+        return "not a 2bit file.\n.";
+    }
+
+    map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        return "could not map 2bit file.\n.";
+    }
+
+    tb->map = (const unsigned char*)map;
+    tb->size = (size_t)sb.st_size;
+#endif
+
+    memcpy(&sig, tb->map, 4);
+
+    if (sig != TB_SIG)
+    {
+        tb->swap = 1;
+
+        if (TwoBitU32(tb, tb->map) != TB_SIG)
+        {
+            TwoBitClose(tb);
+            return "not a 2bit file.\n.";
+        }
+    }
+
+    version = TwoBitU32(tb, tb->map + 4);
+    tb->nSeq = TwoBitU32(tb, tb->map + 8);
+
+    if (version > 1)
+    {
+        TwoBitClose(tb);
+        return "unsupported 2bit file version.\n.";
+    }
+
+    tb->name = (const char**)calloc(tb->nSeq + 1, sizeof(char*));
+    tb->lName = (unsigned char*)calloc(tb->nSeq + 1, 1);
+    tb->offset = (unsigned long long*)calloc(tb->nSeq + 1, sizeof(unsigned long long));
+
+    if (tb->name == NULL || tb->lName == NULL || tb->offset == NULL)
+    {
+        TwoBitClose(tb);
+        return "out of memory.\n.";
+    }
+
+    p = 16;
+
+    for (i = 0; i < tb->nSeq; i++)
+    {
+        if (p + 1 > tb->size || p + 1 + tb->map[p] + (version ? 8 : 4) > tb->size)
+        {
+            TwoBitClose(tb);
+            return "2bit file index is truncated.\n.";
+        }
+
+        tb->lName[i] = tb->map[p];
+        tb->name[i] = (const char*)tb->map + p + 1;
+        p += 1 + tb->lName[i];
+
+        tb->offset[i] = version ? TwoBitU64(tb, tb->map + p) : TwoBitU32(tb, tb->map + p);
+        p += version ? 8 : 4;
+    }
+
+    return NULL;
+}
+
+
+/* index of the sequence called name, -1 if there is none */
+
+static inline int TwoBitFind(const TwoBitFile *tb, const char *name)
+{
+    size_t len = strlen(name);
+    unsigned int i;
+
+    for (i = 0; i < tb->nSeq; i++)
+    {
+        if (tb->lName[i] == len && memcmp(tb->name[i], name, len) == 0) return (int)i;
+    }
+
+    return -1;
+}
+
+
+/* reads the record header of sequence i, returns NULL or an error */
+
+static inline const char *TwoBitSeqGet(const TwoBitFile *tb, int i, TwoBitSeq *s)
+{
+    unsigned long long p, end;
+
+    memset(s, 0, sizeof(*s));
+    s->tb = tb;
+
+    p = tb->offset[i];
+
+    if (p + 8 > tb->size) return "2bit sequence record is truncated.\n.";
+
+    s->len = TwoBitU32(tb, tb->map + p);
+    s->nN = TwoBitU32(tb, tb->map + p + 4);
+    p += 8;
+
+    s->nStart = tb->map + p;
+    s->nSize = s->nStart + 4*(unsigned long long)s->nN;
+    p += 8*(unsigned long long)s->nN;
+
+    if (p + 4 > tb->size) return "2bit sequence record is truncated.\n.";
+
+    s->nMask = TwoBitU32(tb, tb->map + p);
+    p += 4;
+
+    s->mStart = tb->map + p;
+    s->mSize = s->mStart + 4*(unsigned long long)s->nMask;
+    p += 8*(unsigned long long)s->nMask + 4;
+
+    s->dna = tb->map + p;
+    end = p + ((unsigned long long)s->len + 3)/4;
+
+    if (end > tb->size) return "2bit sequence record is truncated.\n.";
+
+    return NULL;
+}
+
+
+/* packed code of base pos, ignoring N runs */
+
+static inline int TwoBitPacked(const TwoBitSeq *s, unsigned int pos)
+{
+    return (s->dna[pos >> 2] >> (6 - 2*(pos & 3))) & 3;
+}
+
+
+/* first run of the n-run / mask table (start, size) that ends after pos */
+
+static inline unsigned int TwoBitFirstRun(const TwoBitSeq *s, const unsigned char *start,
+                                          const unsigned char *size, unsigned int n, unsigned int pos)
+{
+    unsigned int lo = 0, hi = n, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo)/2;
+
+        if ((unsigned long long)TwoBitU32(s->tb, start + 4*mid) + TwoBitU32(s->tb, size + 4*mid) <= pos) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+
+static inline void TwoBitCursorInit(TwoBitCursor *c, const TwoBitSeq *s, unsigned int pos)
+{
+    c->s = s;
+    c->iN = TwoBitFirstRun(s, s->nStart, s->nSize, s->nN, pos);
+    c->nEnd = 0;
+}
+
+
+/* code of base pos (T C A G = 0..3) or TB_N. pos must not decrease
+   between calls */
+
+static inline int TwoBitCode(TwoBitCursor *c, unsigned int pos)
+{
+    const TwoBitSeq *s = c->s;
+    unsigned int start;
+
+    if (pos < c->nEnd) return TB_N;
+
+    while (c->iN < s->nN)
+    {
+        start = TwoBitU32(s->tb, s->nStart + 4*c->iN);
+
+        if (pos < start) break;
+
+        c->nEnd = start + TwoBitU32(s->tb, s->nSize + 4*c->iN);
+        c->iN++;
+
+        if (pos < c->nEnd) return TB_N;
+    }
+
+    return TwoBitPacked(s, pos);
+}
+
+
+/* bases [first, last) of s as text in out (not terminated), N runs as N
+   and soft-masked runs in lower case if mask is set */
+
+static inline void TwoBitDecode(const TwoBitSeq *s, unsigned int first, unsigned int last,
+                                int mask, char *out)
+{
+    static const char bases[4] = {'T', 'C', 'A', 'G'};
+    unsigned int pos, i, a, b;
+
+    for (pos = first; pos < last; pos++)
+    {
+        out[pos - first] = bases[TwoBitPacked(s, pos)];
+    }
+
+    for (i = TwoBitFirstRun(s, s->nStart, s->nSize, s->nN, first); i < s->nN; i++)
+    {
+        a = TwoBitU32(s->tb, s->nStart + 4*i);
+        b = a + TwoBitU32(s->tb, s->nSize + 4*i);
+
+        if (a >= last) break;
+        if (a < first) a = first;
+        if (b > last) b = last;
+
+        memset(out + (a - first), 'N', b - a);
+    }
+
+    if (!mask) return;
+
+    for (i = TwoBitFirstRun(s, s->mStart, s->mSize, s->nMask, first); i < s->nMask; i++)
+    {
+        a = TwoBitU32(s->tb, s->mStart + 4*i);
+        b = a + TwoBitU32(s->tb, s->mSize + 4*i);
+
+        if (a >= last) break;
+        if (a < first) a = first;
+        if (b > last) b = last;
+
+        for (pos = a; pos < b; pos++)
+        {
+            out[pos - first] = (char)(out[pos - first] | 0x20);
+        }
+    }
+}
+
+
+
+/* the bases of a seq argument {twobitfile,name} or {twobitfile,name,
+   region} (region = [first last], 1-based, inclusive) as a string, as
+   mxArrayToString gives one for a text seq: mxCalloc'd and terminated,
+   N runs as N and soft-masked bases in upper case. errors go to
+   mexErrMsgTxt */
+
+static inline char *TwoBitCellToString(const mxArray *cell)
+{
+    TwoBitFile tb;
+    TwoBitSeq s;
+    const mxArray *reg;
+    const char *err;
+    char *fname, *buf;
+    double first, last;
+    int iSeq;
+
+    if (mxGetNumberOfElements(cell) < 2 || mxGetNumberOfElements(cell) > 3
+        || mxGetCell(cell,0) == NULL || !mxIsChar(mxGetCell(cell,0))
+        || mxGetCell(cell,1) == NULL || !mxIsChar(mxGetCell(cell,1)))
+    {
+        mexErrMsgTxt("seq must be a string or {twobitfile,name[,region]}.\n.");
+    }
+
+    fname = mxArrayToString(mxGetCell(cell,0));
+    err = TwoBitOpen(fname, &tb);
+    mxFree(fname);
+
+    if (err != NULL)
+    {
+        mexErrMsgTxt(err);
+    }
+
+    fname = mxArrayToString(mxGetCell(cell,1));
+    iSeq = TwoBitFind(&tb, fname);
+    mxFree(fname);
+
+    err = (iSeq < 0) ? "no sequence of that name in the 2bit file.\n." : TwoBitSeqGet(&tb, iSeq, &s);
+
+    if (err != NULL)
+    {
+        TwoBitClose(&tb);
+        mexErrMsgTxt(err);
+    }
+
+    first = 1;
+    last = s.len;
+
+    if (mxGetNumberOfElements(cell) == 3)
+    {
+        reg = mxGetCell(cell,2);
+
+        if (reg == NULL || !mxIsDouble(reg) || mxGetNumberOfElements(reg) != 2)
+        {
+            TwoBitClose(&tb);
+            mexErrMsgTxt("region must be [first last].\n.");
+        }
+
+        first = mxGetPr(reg)[0];
+        last = mxGetPr(reg)[1];
+
+        if (first < 1 || last < first - 1 || last > s.len)
+        {
+            TwoBitClose(&tb);
+            mexErrMsgTxt("region must lie within 1 and the sequence length.\n.");
+        }
+    }
+
+    buf = (char*)mxCalloc((size_t)(last - first + 2),sizeof(char));
+
+    TwoBitDecode(&s, (unsigned int)first - 1, (unsigned int)last, 0, buf);
+    TwoBitClose(&tb);
+
+    return buf;
+}
+
+
+#endif
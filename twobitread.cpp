@@ -0,0 +1,160 @@
+/*=================================================================
+ *  twobitread.cpp
+ *
+ *  info = twobitread(filename)
+ *  seq = twobitread(filename,name)
+ *  seq = twobitread(filename,name,region)
+ *  seq = twobitread(filename,name,region,mask)
+ *
+ *  reads a UCSC .2bit file (see twobit.h). with only the file name
+ *  returns a struct array with fields Name and Length, one element per
+ *  sequence. otherwise returns the sequence called name, or its bases
+ *  region = [first last] (1-based, inclusive), as a string. N runs are
+ *  returned as N; soft-masked bases are upper case unless mask is true.
+ *
+ *  the file is memory mapped, only the bases asked for are decoded.
+ *
+ *  Brian Kolterman
+ *=================================================================*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include "mex.h"
+#include "twobit.h"
+
+
+#define FNAME    prhs[0]
+#define NAME     prhs[1]
+#define REG      prhs[2]
+#define MASK     prhs[3]
+#define OUT      plhs[0]
+
+
+void mexFunction(int nlhs,mxArray *plhs[],int nrhs,const mxArray *prhs[])
+{
+    char    *fname, *name, *buf;
+    const char *err;
+    const char *fields[2] = {"Name", "Length"};
+    TwoBitFile tb;
+    TwoBitSeq s;
+    int     iSeq, mask;
+    double  first, last;
+    unsigned int i;
+
+
+    // Check for correct number of arguments
+
+    if (nrhs < 1 || nrhs > 4)
+    {
+        mexErrMsgTxt("Usage: info = twobitread(filename) or seq = twobitread(filename,name,region,mask)\n");
+    }
+    if (nlhs > 1)
+    {
+        mexErrMsgTxt("Usage: info = twobitread(filename) or seq = twobitread(filename,name,region,mask)\n");
+    }
+
+    // Check to be sure inputs are correct
+
+    if (!(mxIsChar(FNAME)))
+    {
+        mexErrMsgTxt("filename must be of type string.\n.");
+    }
+    if (nrhs > 1 && !(mxIsChar(NAME)))
+    {
+        mexErrMsgTxt("name must be of type string.\n.");
+    }
+    if (nrhs > 2 && !mxIsEmpty(REG) && (!mxIsDouble(REG) || mxGetNumberOfElements(REG) != 2))
+    {
+        mexErrMsgTxt("region must be [first last].\n.");
+    }
+
+    mask = (nrhs > 3) ? (mxGetScalar(MASK) != 0) : 0;
+
+    fname = mxArrayToString(FNAME);
+    err = TwoBitOpen(fname, &tb);
+    mxFree(fname);
+
+    if (err != NULL)
+    {
+        mexErrMsgTxt(err);
+    }
+
+
+    // Sequence names and lengths
+
+    if (nrhs == 1)
+    {
+        OUT = mxCreateStructMatrix(tb.nSeq, 1, 2, fields);
+
+        buf = (char*)mxCalloc(256,sizeof(char));
+
+        for (i = 0; i < tb.nSeq; i++)
+        {
+            err = TwoBitSeqGet(&tb, (int)i, &s);
+
+            if (err != NULL)
+            {
+                TwoBitClose(&tb);
+                mexErrMsgTxt(err);
+            }
+
+            memcpy(buf, tb.name[i], tb.lName[i]);
+            buf[tb.lName[i]] = 0;
+
+            mxSetField(OUT, i, "Name", mxCreateString(buf));
+            mxSetField(OUT, i, "Length", mxCreateDoubleScalar((double)s.len));
+        }
+
+        mxFree(buf);
+        TwoBitClose(&tb);
+        return;
+    }
+
+
+    // One sequence or region
+
+    name = mxArrayToString(NAME);
+    iSeq = TwoBitFind(&tb, name);
+    mxFree(name);
+
+    if (iSeq < 0)
+    {
+        TwoBitClose(&tb);
+        mexErrMsgTxt("no sequence of that name in the 2bit file.\n.");
+    }
+
+    err = TwoBitSeqGet(&tb, iSeq, &s);
+
+    if (err != NULL)
+    {
+        TwoBitClose(&tb);
+        mexErrMsgTxt(err);
+    }
+
+    first = 1;
+    last = s.len;
+
+    if (nrhs > 2 && !mxIsEmpty(REG))
+    {
+        first = mxGetPr(REG)[0];
+        last = mxGetPr(REG)[1];
+
+        if (first < 1 || last < first - 1 || last > s.len)
+        {
+            TwoBitClose(&tb);
+            mexErrMsgTxt("region must lie within 1 and the sequence length.\n.");
+        }
+    }
+
+    buf = (char*)mxCalloc((size_t)(last - first + 2),sizeof(char));
+
+    TwoBitDecode(&s, (unsigned int)first - 1, (unsigned int)last, mask, buf);
+
+    OUT = mxCreateString(buf);
+
+    mxFree(buf);
+    TwoBitClose(&tb);
+
+    return;
+}